@@ -122,7 +122,7 @@ public:
 
 	///////////////////////////////////////////////////////////////////////
 	// Just assemble the matrix
-	glm::mat4 get_matrix(bool bRotationOnly = false)
+	glm::mat4 get_matrix(bool bRotationOnly = false) const
 	{
 		// Calculate the right side (x) vector, drop it right into the matrix
 		glm::vec3 vXAxis = glm::cross(up, forward);
@@ -148,6 +148,8 @@ public:
 		} else {
 			matrix[3] = glm::vec4(origin, 1.0f);
 		}
+
+		return matrix;
 	}
 
 
@@ -302,13 +304,13 @@ public:
 		glm::vec3 new_world = world - origin;
 
 		// Create the rotation matrix based on the vectors
-		mat4 rot_mat, inv_mat;
+		glm::mat4 rot_mat, inv_mat;
 		rot_mat = get_matrix(true);
 
 		// Do the rotation based on inverted matrix
 		inv_mat = glm::inverse(rot_mat);
 
-		return mat3(inv_mat) * new_world;
+		return glm::mat3(inv_mat) * new_world;
 	}
 
 // 
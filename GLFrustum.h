@@ -34,8 +34,8 @@ ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF S
 #include "utils.h"
 #include "GLFrame.h"
 
-#ifndef __GL_FRAME_CLASS
-#define __GL_FRAME_CLASS
+#ifndef __GL_FRUSTUM_CLASS
+#define __GL_FRUSTUM_CLASS
 
 #define PI (3.14159265358979323846)
 #define TO_RADIANS (PI/180.0)
@@ -162,11 +162,11 @@ glm::mat4 transform(GLFrame& Camera)
 	// backwards - which to do is purely a matter of taste. I chose to
 	// compensate here to allow better operability with some of my other
 	// legacy code and projects. RSW
-	vForward = Camera.GetForwardVector();
+	vForward = Camera.get_forward();
 	vForward = -vForward;
 
-	vUp = Camera.GetUpVector();
-	vOrigin = Camera.GetOrigin();
+	vUp = Camera.get_up();
+	vOrigin = Camera.get_origin();
 	
 	
 	//std::cout<<matrix<<"\n";
@@ -199,78 +199,72 @@ glm::mat4 transform(GLFrame& Camera)
 	farURT = matrix * farUR;
 	farLRT = matrix * farLR;
 
-// 	////////////////////////////////////////////////////
-// 	// Derive Plane Equations from points... Points given in
-// 	// counter clockwise order to make normals point inside 
-// 	// the Frustum
-// 	// Near and Far Planes
-// 	m3dGetPlaneEquation(nearPlane, nearULT, nearLLT, nearLRT);
-// 	m3dGetPlaneEquation(farPlane, farULT, farURT, farLRT);
-// 
-// 	// Top and Bottom Planes
-// 	m3dGetPlaneEquation(topPlane, nearULT, nearURT, farURT);
-// 	m3dGetPlaneEquation(bottomPlane, nearLLT, farLLT, farLRT);
-// 
-// 	// Left and right planes
-// 	m3dGetPlaneEquation(leftPlane, nearLLT, nearULT, farULT);
-// 	m3dGetPlaneEquation(rightPlane, nearLRT, farLRT, farURT);
+	////////////////////////////////////////////////////
+	// Derive Plane Equations from points, the normals are flipped to
+	// point inside the Frustum if the winding says otherwise
+	glm::vec3 center = glm::vec3(nearULT + nearLLT + nearURT + nearLRT + farULT + farLLT + farURT + farLRT) * 0.125f;
+
+	// Near and Far Planes
+	get_plane_equation(nearPlane, nearULT, nearLLT, nearLRT, center);
+	get_plane_equation(farPlane, farULT, farURT, farLRT, center);
+
+	// Top and Bottom Planes
+	get_plane_equation(topPlane, nearULT, nearURT, farURT, center);
+	get_plane_equation(bottomPlane, nearLLT, farLLT, farLRT, center);
+
+	// Left and right planes
+	get_plane_equation(leftPlane, nearLLT, nearULT, farULT, center);
+	get_plane_equation(rightPlane, nearLRT, farLRT, farURT, center);
 	
 	
 	return matrix;
 }
 
 
+// Plane through 3 points as (normal, d), dot(normal, p) + d is the signed
+// distance of p.  inside ends up on the positive side.
+static void get_plane_equation(glm::vec4& plane, const glm::vec4& p1, const glm::vec4& p2, const glm::vec4& p3, const glm::vec3& inside)
+{
+	glm::vec3 a(p1), b(p2), c(p3);
+	glm::vec3 n = glm::normalize(glm::cross(b - a, c - a));
+	plane = glm::vec4(n, -glm::dot(n, a));
+
+	if (glm::dot(n, inside) + plane.w < 0.0f)
+		plane = -plane;
+}
+
+
+	// Allow expanded version of sphere test
+	bool test_sphere(float x, float y, float z, float radius) const
+	{
+		return test_sphere(glm::vec3(x, y, z), radius);
+	}
+
+	// Test a point against all frustum planes. A negative distance for any
+	// single plane means it is outside the frustum. The radius value allows
+	// to test for a point (radius = 0), or a sphere.
+	// Returns false if it is not in the frustum, true if it intersects
+	// the Frustum.  Only valid after transform().
+	bool test_sphere(const glm::vec3& point, float radius) const
+	{
+		const glm::vec4* planes[6] = { &nearPlane, &farPlane, &leftPlane, &rightPlane, &bottomPlane, &topPlane };
+		for (int i=0; i<6; ++i) {
+			if (glm::dot(glm::vec3(*planes[i]), point) + planes[i]->w + radius <= 0.0f)
+				return false;
+		}
+		return true;
+	}
 
-// 	// Allow expanded version of sphere test
-// 	bool TestSphere(float x, float y, float z, float fRadius)
-// 	{
-// 		glm::vec3f vPoint;
-// 		vPoint[0] = x;
-// 		vPoint[1] = y;
-// 		vPoint[2] = z;
-// 
-// 		return TestSphere(vPoint, fRadius);
-// 	}
-// 
-// 	// Test a point against all frustum planes. A negative distance for any
-// 	// single plane means it is outside the frustum. The radius value allows
-// 	// to test for a point (radius = 0), or a sphere. Possibly there might
-// 	// be some gain in an alternative function that saves the addition of 
-// 	// zero in this case.
-// 	// Returns false if it is not in the frustum, true if it intersects
-// 	// the Frustum.
-// 	bool TestSphere(glm::vec3f vPoint, float fRadius)
-// 	{
-// 		float fDist;
-// 
-// 		// Near Plane - See if it is behind me
-// 		fDist = m3dGetDistanceToPlane(vPoint, nearPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		// Distance to far plane
-// 		fDist = m3dGetDistanceToPlane(vPoint, farPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		fDist = m3dGetDistanceToPlane(vPoint, leftPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		fDist = m3dGetDistanceToPlane(vPoint, rightPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		fDist = m3dGetDistanceToPlane(vPoint, bottomPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		fDist = m3dGetDistanceToPlane(vPoint, topPlane);
-// 		if(fDist + fRadius <= 0.0)
-// 		return false;
-// 
-// 		return true;
-// 	}
+	// The 6 planes in the order near, far, left, right, bottom, top
+	void get_planes(glm::vec4* out) const
+	{
+		out[0] = nearPlane;
+		out[1] = farPlane;
+		out[2] = leftPlane;
+		out[3] = rightPlane;
+		out[4] = bottomPlane;
+		out[5] = topPlane;
+	}
 
 	// The projection matrix for this frustum
 	glm::mat4 proj_mat;	
@@ -7,49 +7,188 @@
 
 #include "Mesh.h"
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
 
-void Mesh::end()
-{
-	
-	
-	// Create the master vertex array object if not already created
-	if (!vbo) {
-		glGenVertexArrays(1, &vbo);
-		glBindVertexArray(vbo);
-		
-	
-		glGenBuffers(1, bufferobjects);
-	}
-	
-	
-	// Vertex data
-    glBindBuffer(GL_ARRAY_BUFFER, bufferobjects[0]);
-	glEnableVertexAttribArray(ATTRIBUTE_VERTEX);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*verts.size()*3, &verts[0], GL_STATIC_DRAW);
-	
-	glVertexAttribPointer(ATTRIBUTE_VERTEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+//FNV style mix of the 3 float bit patterns (or grid cells)
+static inline unsigned int hash3(unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int h = 2166136261u;
+	h = (h ^ a) * 16777619u;
+	h = (h ^ b) * 16777619u;
+	h = (h ^ c) * 16777619u;
+	return h ^ (h >> 15);
+}
 
+static inline unsigned int float_bits(float f)
+{
+	unsigned int u;
+	f += 0.0f;	//-0.0 -> 0.0 so they hash the same
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
 
-	//add more bindings here for textures, colors, normals etc.
 
-	
-	// Done
-	glBindVertexArray(0);
+//every byte except the position has to match
+static inline bool same_attribs(const unsigned char* a, const unsigned char* b, size_t stride, size_t pos_offset)
+{
+	size_t pos_end = pos_offset + sizeof(glm::vec3);
+	return !memcmp(a, b, pos_offset) && !memcmp(a+pos_end, b+pos_end, stride-pos_end);
 }
 
 
-void Mesh::draw()
+//Open addressing table of unique vertex numbers.  With an epsilon several
+//unique vertices can share a cell so lookups walk the probe sequence and
+//check every entry with a matching cell.
+void weld_vertices(const void* verts, size_t count, size_t stride, size_t pos_offset, float epsilon,
+                   std::vector<GLuint>& out_indices, std::vector<GLuint>& unique_src)
 {
-	glBindVertexArray(vbo);
-	glDrawArrays(primitive, 0, verts.size());
-	glBindVertexArray(0);
+	const GLuint empty = ~GLuint(0);
+	const unsigned char* data = (const unsigned char*)verts;
+
+	size_t table_size = 16;
+	while (table_size < count*2)
+		table_size <<= 1;
+	size_t mask = table_size - 1;
+
+	std::vector<GLuint> table(table_size, empty);
+	std::vector<glm::ivec3> cells;
+
+	unique_src.clear();
+	out_indices.resize(count);
+
+	float inv_eps = (epsilon > 0.0f) ? 1.0f/epsilon : 0.0f;
+
+	for (size_t i=0; i<count; ++i) {
+		const unsigned char* vp = data + i*stride;
+		glm::vec3 v;
+		memcpy(&v, vp + pos_offset, sizeof(v));
+		GLuint found = empty;
+
+		if (epsilon <= 0.0f) {
+			size_t h = hash3(float_bits(v.x), float_bits(v.y), float_bits(v.z)) & mask;
+			for (; table[h] != empty; h = (h+1) & mask) {
+				const unsigned char* up = data + unique_src[table[h]]*stride;
+				glm::vec3 u;
+				memcpy(&u, up + pos_offset, sizeof(u));
+				if (u == v && same_attribs(up, vp, stride, pos_offset)) {
+					found = table[h];
+					break;
+				}
+			}
+			if (found == empty) {
+				found = unique_src.size();
+				table[h] = found;
+				unique_src.push_back(i);
+			}
+		} else {
+			glm::ivec3 c(int(floorf(v.x*inv_eps)), int(floorf(v.y*inv_eps)), int(floorf(v.z*inv_eps)));
+
+			//anything within epsilon is in this or an adjacent cell
+			for (int dz=-1; dz<=1 && found == empty; ++dz) {
+			for (int dy=-1; dy<=1 && found == empty; ++dy) {
+			for (int dx=-1; dx<=1 && found == empty; ++dx) {
+				glm::ivec3 nc(c.x+dx, c.y+dy, c.z+dz);
+				size_t h = hash3(nc.x, nc.y, nc.z) & mask;
+				for (; table[h] != empty; h = (h+1) & mask) {
+					GLuint u = table[h];
+					if (cells[u] != nc)
+						continue;
+					const unsigned char* up = data + unique_src[u]*stride;
+					glm::vec3 d;
+					memcpy(&d, up + pos_offset, sizeof(d));
+					d -= v;
+					if (fabsf(d.x) <= epsilon && fabsf(d.y) <= epsilon && fabsf(d.z) <= epsilon &&
+					    same_attribs(up, vp, stride, pos_offset)) {
+						found = u;
+						break;
+					}
+				}
+			}
+			}
+			}
+
+			if (found == empty) {
+				found = unique_src.size();
+				size_t h = hash3(c.x, c.y, c.z) & mask;
+				while (table[h] != empty)
+					h = (h+1) & mask;
+				table[h] = found;
+				unique_src.push_back(i);
+				cells.push_back(c);
+			}
+		}
+
+		out_indices[i] = found;
+	}
+}
 
+
+static bool range_less(const DirtyRange& a, const DirtyRange& b)
+{
+	return a.first < b.first;
 }
 
+void coalesce_ranges(std::vector<DirtyRange>& ranges, size_t gap)
+{
+	if (ranges.size() < 2)
+		return;
+
+	std::sort(ranges.begin(), ranges.end(), range_less);
+
+	size_t out = 0;
+	for (size_t i=1; i<ranges.size(); ++i) {
+		if (ranges[i].first <= ranges[out].last + gap) {
+			if (ranges[i].last > ranges[out].last)
+				ranges[out].last = ranges[i].last;
+		} else {
+			ranges[++out] = ranges[i];
+		}
+	}
+	ranges.resize(out+1);
+}
 
 
+void pack_instance_matrices(const GLFrame* frames, size_t count, glm::mat4* out)
+{
+	for (size_t i=0; i<count; ++i)
+		out[i] = frames[i].get_matrix();
+}
 
 
+//rotation part of the frame as a quaternion (Shoemake's method)
+static glm::vec4 frame_quaternion(const GLFrame& f)
+{
+	glm::vec3 x = glm::cross(f.up, f.forward);
+	const glm::vec3& y = f.up;
+	const glm::vec3& z = f.forward;
+
+	glm::vec4 q;
+	float trace = x.x + y.y + z.z;
+	if (trace > 0.0f) {
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		q = glm::vec4((y.z - z.y) / s, (z.x - x.z) / s, (x.y - y.x) / s, 0.25f * s);
+	} else if (x.x > y.y && x.x > z.z) {
+		float s = sqrtf(1.0f + x.x - y.y - z.z) * 2.0f;
+		q = glm::vec4(0.25f * s, (y.x + x.y) / s, (z.x + x.z) / s, (y.z - z.y) / s);
+	} else if (y.y > z.z) {
+		float s = sqrtf(1.0f + y.y - x.x - z.z) * 2.0f;
+		q = glm::vec4((y.x + x.y) / s, 0.25f * s, (z.y + y.z) / s, (z.x - x.z) / s);
+	} else {
+		float s = sqrtf(1.0f + z.z - x.x - y.y) * 2.0f;
+		q = glm::vec4((z.x + x.z) / s, (z.y + y.z) / s, 0.25f * s, (x.y - y.x) / s);
+	}
+	return q;
+}
 
 
+void pack_instance_compact(const GLFrame* frames, size_t count, const float* scales, glm::vec4* out)
+{
+	for (size_t i=0; i<count; ++i) {
+		out[i*2] = glm::vec4(frames[i].origin, scales ? scales[i] : 1.0f);
+		out[i*2+1] = frame_quaternion(frames[i]);
+	}
+}
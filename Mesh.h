@@ -8,52 +8,1209 @@
 #define TRIANGLEMESH_H
 
 #include <vector>
+#include <utility>
+#include <functional>
+#include <string.h>
+#include <assert.h>
 #include <glm/glm.hpp>
 #include <GL/glew.h>
 
+#include "vertex_layout.h"
+#include "mesh_optimize.h"
+#include "meshlet.h"
+#include "mesh_simplify.h"
+#include "mesh_normals.h"
+#include "mesh_bounds.h"
+#include "mesh_strip.h"
+#include "gpu_budget.h"
+#include "stream_buffer.h"
+#include "GLFrame.h"
 
-#define ATTRIBUTE_VERTEX	0
 
-class Mesh
+//vertices [first, last) that changed since the last upload
+struct DirtyRange
+{
+	size_t first, last;
+};
+
+//Sorts ranges and merges any that overlap or are within gap vertices of
+//each other, one glBufferSubData over a small gap beats two calls.
+void coalesce_ranges(std::vector<DirtyRange>& ranges, size_t gap);
+
+
+//Per instance data formats for Mesh::set_instances().  In the vertex shader
+//INSTANCE_MATRIX is "layout(location = ATTRIBUTE_INSTANCE) in mat4 model;"
+//INSTANCE_COMPACT is 2 vec4s, position + uniform scale in w, then a unit
+//quaternion (xyz, w):  p = pos_scale.xyz + pos_scale.w * (v + 2.0*cross(q.xyz, cross(q.xyz, v) + q.w*v))
+enum
+{
+	INSTANCE_MATRIX,
+	INSTANCE_COMPACT
+};
+
+void pack_instance_matrices(const GLFrame* frames, size_t count, glm::mat4* out);
+void pack_instance_compact(const GLFrame* frames, size_t count, const float* scales, glm::vec4* out);
+
+
+//Vertex is any struct with a vertex_format specialization (see vertex_layout.h).
+//All attributes go into one interleaved buffer, Mesh<> is the old positions only mesh.
+//Alloc is verts' allocator, eg ArenaAllocator (arena.h) for throwaway meshes.
+//Its GPU memory can be capped with a GpuBudget (gpu_budget.h), evicted
+//meshes upload again when they're next drawn.  Instanced meshes stay resident.
+template<class Vertex = glm::vec3, class Alloc = std::allocator<Vertex> >
+class Mesh : public GpuResource
 {
 public:
-	std::vector<glm::vec3> verts;
+	typedef typename vertex_format<Vertex>::layout layout;
+	typedef std::vector<Vertex, Alloc> vertex_vector;
+
+	//Writing verts directly after the first end() needs a mark_dirty() for the
+	//change to be uploaded; set_vertex() and friends do it for you.
+	vertex_vector verts;
+	std::vector<GLuint> indices;	//filled by weld() or directly by the user
+
 
-	
 	GLenum primitive;
-	GLuint bufferobjects[10];
-	GLuint vbo, normal_vbo;		//vertexArrayBufferObject
-	
-	Mesh()
+	GLuint vao;			//vertex array object
+	GLuint vbo;			//interleaved vertex data
+	GLuint ibo;			//index data
+
+	bool indexed;			//draw with glDrawElements, weld in end() if no indices were given
+	float weld_epsilon;		//0 means only bitwise identical positions are merged
+	GLenum index_type;		//GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, chosen in end()
+
+	bool optimize_cache;	//reorder triangles and vertices in end(), GL_TRIANGLES only
+	bool reorder_pending;	//indices changed since the last optimize()
+	VertexCacheStats stats_before, stats_after;	//filled by optimize()
+
+	//what draw() uses, set by end()
+	GLsizei draw_count;
+	GLint base_vertex;
+	size_t index_offset;
+
+	//streaming meshes write into a ring instead of calling glBufferData in end()
+	bool streaming;
+	StreamBuffer vstream, istream;
+	bool stream_mapped;		//map_vertices() was called since the last end()
+
+	//partial upload bookkeeping for static meshes
+	std::vector<DirtyRange> dirty;
+	bool all_dirty;			//next end() uploads every vertex
+	bool indices_dirty;
+	size_t gpu_capacity;		//vertices the vbo has room for
+	size_t gpu_count;		//vertices uploaded so far
+
+	//VF_UNORM16_BOX positions are relative to this, see dequant_matrix()
+	QuantBox quant;
+
+	//box and bounding sphere of the positions for culling, recomputed in
+	//end() only when vertices changed.  Not updated for map_vertices().
+	Bounds bounds;
+	unsigned int bounds_threads;	//0 is one per core
+
+	//per instance stream for draw_instanced()
+	GLuint instance_vbo;
+	int instance_format;
+	GLsizei instance_count;
+
+	//clusters for draw_clusters(), rebuilt in end() whenever the indices change
+	bool clustered;
+	GLuint cluster_max_verts, cluster_max_tris;
+	std::vector<Meshlet> meshlets;
+
+	//lods[0] is the mesh itself, the simplified levels' indices follow the
+	//base ones in the ibo.  Rebuilt in end() whenever the indices change.
+	std::vector<MeshLod> lods;
+	std::vector<GLuint> lod_indices;
+	GLuint lod_levels;
+	float lod_ratio;
+
+	//set_strips(): the ibo holds strip_indices (restart joined strips drawn
+	//as GL_TRIANGLE_STRIP) instead of the list whenever that's smaller
+	bool try_strips;
+	bool stripped;
+	std::vector<GLuint> strip_indices;
+
+	//end_async() (upload_queue.h) in flight, the draw calls do nothing
+	//until resident()
+	bool uploading;
+	GLsync upload_fence;
+
+	//GPU bytes besides the vbo (gpu_capacity vertices), see update_gpu_size()
+	size_t ibo_bytes, instance_bytes;
+
+	//How to get the data back after an eviction when verts is empty, set
+	//by load_mesh_cache().  Meshes with neither are never evicted.
+	std::function<bool(Mesh&)> reload;
+
+	Mesh(GLenum p = GL_POINTS, const Alloc& alloc = Alloc()) : verts(alloc)
 	{
-		vbo = 0;
-		primitive = GL_POINTS;
+		vao = vbo = ibo = 0;
+		primitive = p;
+		indexed = false;
+		weld_epsilon = 0.0f;
+		index_type = GL_UNSIGNED_INT;
+		optimize_cache = false;
+		reorder_pending = true;
+		draw_count = 0;
+		base_vertex = 0;
+		index_offset = 0;
+		streaming = false;
+		stream_mapped = false;
+		all_dirty = true;
+		indices_dirty = true;
+		gpu_capacity = 0;
+		gpu_count = 0;
+		instance_vbo = 0;
+		instance_format = -1;
+		instance_count = 0;
+		clustered = false;
+		cluster_max_verts = MESHLET_MAX_VERTS;
+		cluster_max_tris = MESHLET_MAX_TRIS;
+		lod_levels = 0;
+		lod_ratio = 0.5f;
+		try_strips = false;
+		stripped = false;
+		uploading = false;
+		upload_fence = 0;
+		ibo_bytes = instance_bytes = 0;
+		bounds.min = bounds.max = bounds.center = glm::vec3(0.0f);
+		bounds.radius = 0.0f;
+		bounds_threads = 0;
+		set_quant_box(quant, glm::vec3(0.0f), glm::vec3(1.0f));
 	}
-	Mesh(GLenum p)
+
+	//Take over already built vertex (and index) data without copying it
+	Mesh(vertex_vector&& v, GLenum p = GL_POINTS) : Mesh(p, v.get_allocator())
 	{
-		vbo = 0;
-		primitive = p;
+		verts = std::move(v);
+	}
+
+	Mesh(vertex_vector&& v, std::vector<GLuint>&& idx, GLenum p) : Mesh(p, v.get_allocator())
+	{
+		verts = std::move(v);
+		indices = std::move(idx);
+		indexed = true;
 	}
 
 	~Mesh()
 	{
-		;
+		release_gl();
 	}
-	
-	
-	void add_vertex(glm::vec3 a) { verts.push_back(a); }
-	
+
+
+	//capacity hints, building a big mesh one vertex at a time otherwise
+	//reallocates and copies every time verts fills up
+	void reserve(size_t vertex_count, size_t index_count = 0)
+	{
+		verts.reserve(vertex_count);
+		indices.reserve(index_count);
+	}
+
+	void add_vertex(const Vertex& a) { verts.push_back(a); }
+
 	void add_vertex(float x, float y, float z) { verts.push_back(glm::vec3(x, y, z)); }
 
-	void clear() { verts.clear(); }
-	
+	void add_vertices(const Vertex* v, size_t count) { verts.insert(verts.end(), v, v + count); }
+
+	//constructs in place from Vertex's constructor arguments
+	template<class... Args>
+	Vertex& emplace_vertex(Args&&... args)
+	{
+		verts.emplace_back(std::forward<Args>(args)...);
+		return verts.back();
+	}
+
+	void add_triangle(GLuint a, GLuint b, GLuint c)
+	{
+		indices.push_back(a); indices.push_back(b); indices.push_back(c);
+		indices_dirty = reorder_pending = true;
+	}
+
+	void add_triangles(const GLuint* idx, size_t count)
+	{
+		indices.insert(indices.end(), idx, idx + count);
+		indices_dirty = reorder_pending = true;
+	}
+
+	void clear()
+	{
+		verts.clear(); indices.clear(); dirty.clear();
+		all_dirty = indices_dirty = reorder_pending = true;
+		gpu_count = 0;
+	}
+
+
+	//vertex writes that only re-upload what changed in the next end()
+	void set_vertex(size_t i, const Vertex& v) { verts[i] = v; mark_dirty(i, 1); }
+
+	//first + count can't be past the end, verts isn't grown
+	void set_vertices(size_t first, const Vertex* v, size_t count)
+	{
+		if (!count)
+			return;
+		assert(first <= verts.size() && count <= verts.size() - first);
+		memcpy(&verts[first], v, count*sizeof(Vertex));
+		mark_dirty(first, count);
+	}
+
+	Vertex& edit_vertex(size_t i) { mark_dirty(i, 1); return verts[i]; }
+
+	void mark_dirty(size_t first, size_t count)
+	{
+		if (!count)
+			return;
+		DirtyRange r = { first, first + count };
+		dirty.push_back(r);
+	}
+
+	void mark_indices_dirty() { indices_dirty = reorder_pending = true; }
+
+	void set_indexed(bool on, float epsilon = 0.0f) { indexed = on; weld_epsilon = epsilon; }
+
+	//Reorders in the first end() after the indices change, which uploads the
+	//whole mesh.  Vertex edits after that keep their numbers and the next
+	//end() only uploads the dirty ranges like any other mesh.
+	void set_optimize(bool on) { optimize_cache = on; reorder_pending = reorder_pending || on; }
+
+	//for geometry that changes every frame, call before the first end()
+	void set_streaming(bool on) { streaming = on; }
+
+	//Partition into meshlets in end() so draw_clusters() can skip the ones
+	//off screen or facing away.  Indexed, static GL_TRIANGLES meshes only.
+	void set_clusters(bool on, GLuint max_verts = MESHLET_MAX_VERTS, GLuint max_tris = MESHLET_MAX_TRIS)
+	{
+		clustered = on;
+		cluster_max_verts = max_verts;
+		cluster_max_tris = max_tris;
+		indices_dirty = true;
+	}
+
+	//Generate up to levels simplified versions in end(), each with about
+	//ratio times the triangles of the one before.  Indexed, static
+	//GL_TRIANGLES meshes only.
+	void set_lods(GLuint levels, float ratio = 0.5f)
+	{
+		lod_levels = levels;
+		lod_ratio = ratio;
+		indices_dirty = true;
+		if (!levels) {
+			lods.clear();
+			lod_indices.clear();
+		}
+	}
+
+	//Strip the triangles in end() (see stripify()) and keep whichever of
+	//strips and list is the smaller index buffer.  Indexed, static
+	//GL_TRIANGLES meshes without clusters or lods only; indices stays the list.
+	//Needs GL_PRIMITIVE_RESTART_FIXED_INDEX (GL 4.3 or ARB_ES3_compatibility),
+	//without it the list is always kept.
+	void set_strips(bool on) { try_strips = on; indices_dirty = true; }
+
+	//Streaming only: returns count vertices of GPU visible memory to write
+	//directly instead of filling verts, then call end() as usual.
+	Vertex* map_vertices(size_t count);
+
+
+	//Uploads one transform per instance for draw_instanced().  scales is
+	//optional and only used by INSTANCE_COMPACT.  Call after end().
+	void set_instances(const GLFrame* frames, size_t count, int format = INSTANCE_MATRIX, const float* scales = NULL);
+	void set_instances(const glm::mat4* models, size_t count);
+
+	//Maps box relative positions back to model space, identity unless the
+	//layout uses VF_UNORM16_BOX.  Multiply it in after the model matrix.
+	glm::mat4 dequant_matrix() const
+	{
+		glm::mat4 m(1.0f);
+		if (layout::needs_box) {
+			m[0][0] = quant.extent.x;
+			m[1][1] = quant.extent.y;
+			m[2][2] = quant.extent.z;
+			m[3] = glm::vec4(quant.min, 1.0f);
+		}
+		return m;
+	}
 
+
+	void weld();
+	void optimize();
+
+	//The CPU side of end(): weld, optimize and rebuild bounds, clusters and
+	//lods as needed.  Touches nothing but the mesh so it can run on another
+	//thread, which is what end_async() does.
+	void prepare();
+
+	//True once the last end_async() upload has landed (its fence signaled).
+	//Always true for meshes uploaded with end().
+	bool resident()
+	{
+		if (uploading)
+			return false;
+		if (upload_fence) {
+			if (glClientWaitSync(upload_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+				return false;
+			glDeleteSync(upload_fence);
+			upload_fence = 0;
+		}
+		return true;
+	}
+
+	//Smooth normals, and tangents (sign in w) for normal mapping, from the
+	//triangles using every core (see mesh_normals.h).  GL_TRIANGLES only,
+	//tangents need the normals and uvs.  The next end() uploads them.
+	void generate_normals(unsigned int threads = 0);
+	void generate_tangents(unsigned int threads = 0);
 	void end();
 	void draw();
 
+	//Reports the GPU memory held to the budget (if any), end() and friends
+	//call it after every upload.
+	void update_gpu_size();
+
+	//Uploads vertex (already in the GPU format, see gpu_vertex) and index
+	//data straight from memory, eg a mapped cache file.  Nothing is kept on
+	//the CPU: verts, indices and everything built from them (lods, meshlets,
+	//strips) are freed, so only reload can bring it back after an eviction.
+	//stripped is the caller's.  gpu_indices can be NULL.
+	void end(const void* gpu_verts, size_t vcount, const void* gpu_indices, size_t icount, GLenum itype);
+	void draw_instanced(GLsizei count);
+
+	//Culls the meshlets (see cull_meshlets for the arguments) and draws what's
+	//left with one glMultiDrawElements.  Returns the triangles drawn.
+	GLsizei draw_clusters(const glm::vec4* planes, const glm::mat4& model, const glm::vec3& camera);
+
+	//Coarsest level whose error, projected with proj (eg GLFrustum::proj_mat)
+	//for a viewport viewport_height pixels high, is at most pixel_error pixels.
+	int select_lod(const glm::vec3& camera, const glm::mat4& proj, const glm::mat4& model,
+	               float viewport_height, float pixel_error = 1.0f) const;
+	int select_lod(GLFrame& camera, const glm::mat4& proj, const glm::mat4& model,
+	               float viewport_height, float pixel_error = 1.0f) const
+	{
+		return select_lod(camera.get_origin(), proj, model, viewport_height, pixel_error);
+	}
+
+	void draw_lod(int lod);
+
+protected:
+	bool evict();
+
+private:
+	void upload();
+	void release_gl();
+	bool restore();
+	bool ready();
+
+	void build_lods();
+	void update_bounds();
+	const GLuint* triangle_list(std::vector<GLuint>& tmp, size_t& count);
+
+	//scratch for draw_clusters()
+	std::vector<GLuint> visible_meshlets;
+	std::vector<GLsizei> cluster_counts;
+	std::vector<const GLvoid*> cluster_offsets;
+
+	void reserve_stream(StreamBuffer& stream, GLenum target, size_t bytes, size_t granularity);
+	void end_stream();
+	void upload_vertices();
+	void upload_range(size_t first, size_t count);
+	void update_quant_box();
+	void* map_stream(size_t count);
+	void upload_instances(const void* data, size_t bytes, size_t count, int format);
+
 };
 
 
+//Merges duplicate vertices in an interleaved array.  Two vertices are the same
+//if their positions (at pos_offset) are within epsilon per component
+//(epsilon == 0 means bitwise equal) and every other byte matches.
+//out_indices gets the unique vertex for each input vertex and unique_src the
+//input vertex each unique one was taken from.
+void weld_vertices(const void* verts, size_t count, size_t stride, size_t pos_offset, float epsilon,
+                   std::vector<GLuint>& out_indices, std::vector<GLuint>& unique_src);
+
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::weld()
+{
+	if (verts.empty())
+		return;
+
+	std::vector<GLuint> unique_src;
+	weld_vertices(&verts[0], verts.size(), sizeof(Vertex), layout::offset_of(ATTRIBUTE_VERTEX),
+	              weld_epsilon, indices, unique_src);
+
+	vertex_vector unique(verts.get_allocator());
+	unique.reserve(unique_src.size());
+	for (size_t i=0; i<unique_src.size(); ++i)
+		unique.push_back(verts[unique_src[i]]);
+	verts.swap(unique);
+
+	all_dirty = indices_dirty = reorder_pending = true;
+}
+
+
+//Forsyth triangle order first, then number the vertices in the order the
+//new index stream first touches them so fetches walk the buffer linearly
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::optimize()
+{
+	stats_before = analyze_vertex_cache(&indices[0], indices.size(), verts.size());
+
+	optimize_vertex_cache(&indices[0], indices.size(), verts.size());
+
+	std::vector<GLuint> remap;
+	size_t used = optimize_vertex_fetch(remap, &indices[0], indices.size(), verts.size());
+	remap_vertices(verts, remap, used);
+
+	stats_after = analyze_vertex_cache(&indices[0], indices.size(), verts.size());
+
+	all_dirty = indices_dirty = true;
+	reorder_pending = false;
+}
+
+
+//indices, or 0..n-1 in tmp for a non indexed mesh
+template<class Vertex, class Alloc>
+const GLuint* Mesh<Vertex, Alloc>::triangle_list(std::vector<GLuint>& tmp, size_t& count)
+{
+	if (indexed && indices.empty())
+		weld();
+
+	if (indexed) {
+		count = indices.size();
+		return &indices[0];
+	}
+
+	tmp.resize(verts.size());
+	for (size_t i=0; i<tmp.size(); ++i)
+		tmp[i] = i;
+	count = tmp.size();
+	return &tmp[0];
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::generate_normals(unsigned int threads)
+{
+	static_assert(layout::components_of(ATTRIBUTE_NORMAL) == 3, "vertex format has no vec3 ATTRIBUTE_NORMAL");
+
+	if (primitive != GL_TRIANGLES || verts.empty())
+		return;
+
+	std::vector<GLuint> tmp;
+	size_t count;
+	const GLuint* tris = triangle_list(tmp, count);
+
+	compute_normals(&verts[0], verts.size(), sizeof(Vertex), layout::offset_of(ATTRIBUTE_VERTEX),
+	                layout::offset_of(ATTRIBUTE_NORMAL), tris, count, threads);
+	mark_dirty(0, verts.size());
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::generate_tangents(unsigned int threads)
+{
+	static_assert(layout::components_of(ATTRIBUTE_NORMAL) == 3, "vertex format has no vec3 ATTRIBUTE_NORMAL");
+	static_assert(layout::components_of(ATTRIBUTE_TEXCOORD) == 2, "vertex format has no vec2 ATTRIBUTE_TEXCOORD");
+	static_assert(layout::components_of(ATTRIBUTE_TANGENT) == 4, "vertex format has no vec4 ATTRIBUTE_TANGENT");
+
+	if (primitive != GL_TRIANGLES || verts.empty())
+		return;
+
+	std::vector<GLuint> tmp;
+	size_t count;
+	const GLuint* tris = triangle_list(tmp, count);
+
+	compute_tangents(&verts[0], verts.size(), sizeof(Vertex), layout::offset_of(ATTRIBUTE_VERTEX),
+	                 layout::offset_of(ATTRIBUTE_NORMAL), layout::offset_of(ATTRIBUTE_TEXCOORD),
+	                 layout::offset_of(ATTRIBUTE_TANGENT), tris, count, threads);
+	mark_dirty(0, verts.size());
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::prepare()
+{
+	if (indexed && indices.empty())
+		weld();
+
+	//only after the indices changed, reordering renumbers verts and a later
+	//set_vertex() has to find the vertex it was given last time
+	if (reorder_pending && indexed && optimize_cache && primitive == GL_TRIANGLES && !indices.empty())
+		optimize();
+
+	update_bounds();
+	if (layout::needs_box && !streaming)
+		update_quant_box();
+
+	if (clustered && indices_dirty && indexed && primitive == GL_TRIANGLES && !streaming && !indices.empty()) {
+		build_meshlets(meshlets, &indices[0], indices.size(), &verts[0], verts.size(), sizeof(Vertex),
+		               layout::offset_of(ATTRIBUTE_VERTEX), cluster_max_verts, cluster_max_tris);
+	}
+
+	if (lod_levels && indices_dirty && indexed && primitive == GL_TRIANGLES && !streaming && !indices.empty())
+		build_lods();
+
+	if (indices_dirty) {
+		stripped = false;
+		if (try_strips && (GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility) &&
+		    indexed && primitive == GL_TRIANGLES && !streaming && !clustered &&
+		    lod_indices.empty() && !indices.empty()) {
+			stripped = stripify(strip_indices, &indices[0], indices.size(), verts.size()) < indices.size();
+		}
+		if (!stripped)
+			std::vector<GLuint>().swap(strip_indices);
+	}
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::end()
+{
+	prepare();
+	upload();
+}
+
+
+//the GL half of end()
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::upload()
+{
+	if (streaming) {
+		end_stream();
+		update_gpu_size();
+		return;
+	}
+
+	//lods and strips never both exist, see prepare()
+	const std::vector<GLuint>& base_indices = stripped ? strip_indices : indices;
+
+	draw_count = indexed ? base_indices.size() : verts.size();
+	base_vertex = 0;
+	index_offset = 0;
+
+	// Create the master vertex array object if not already created
+	if (!vao) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+		//offsets and types are all compile time constants
+		gpu_vertex<Vertex>::setup();
+	} else {
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	}
+
+
+	// Vertex data, every attribute interleaved
+	upload_vertices();
+
+
+	// Index data, 16 bit whenever every vertex can be addressed with it
+	if (indexed) {
+		GLenum type = (verts.size() <= 0xFFFF) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		if (type != index_type)
+			indices_dirty = true;
+
+		if (!ibo) {
+			glGenBuffers(1, &ibo);
+			indices_dirty = true;
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		if (indices_dirty) {
+			index_type = type;
+			if (index_type == GL_UNSIGNED_SHORT) {
+				std::vector<GLushort> short_indices(base_indices.begin(), base_indices.end());
+				short_indices.insert(short_indices.end(), lod_indices.begin(), lod_indices.end());
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*short_indices.size(),
+				             short_indices.empty() ? NULL : &short_indices[0], GL_STATIC_DRAW);
+				ibo_bytes = sizeof(GLushort)*short_indices.size();
+			} else if (lod_indices.empty()) {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*base_indices.size(),
+				             base_indices.empty() ? NULL : &base_indices[0], GL_STATIC_DRAW);
+				ibo_bytes = sizeof(GLuint)*base_indices.size();
+			} else {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*(indices.size() + lod_indices.size()), NULL, GL_STATIC_DRAW);
+				if (!indices.empty())
+					glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(GLuint)*indices.size(), &indices[0]);
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), sizeof(GLuint)*lod_indices.size(), &lod_indices[0]);
+				ibo_bytes = sizeof(GLuint)*(indices.size() + lod_indices.size());
+			}
+			indices_dirty = false;
+		}
+	}
+
+
+	// Done
+	glBindVertexArray(0);
+	update_gpu_size();
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::update_gpu_size()
+{
+	size_t bytes = instance_bytes;
+	if (streaming)
+		bytes += (vstream.region_size + istream.region_size) * STREAM_REGIONS;
+	else
+		bytes += gpu_capacity * gpu_vertex<Vertex>::stride + ibo_bytes;
+	set_gpu_size(bytes);
+}
+
+
+//Everything GL, the CPU side data stays.  Instances have to be set again,
+//evict() never gets here with any since there's no copy of them to restore.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::release_gl()
+{
+	if (upload_fence)
+		glDeleteSync(upload_fence);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	if (instance_vbo)
+		glDeleteBuffers(1, &instance_vbo);
+	if (streaming) {
+		vstream.release();
+		istream.release();
+	} else {
+		if (vbo)
+			glDeleteBuffers(1, &vbo);
+		if (ibo)
+			glDeleteBuffers(1, &ibo);
+	}
+
+	upload_fence = 0;
+	vao = vbo = ibo = instance_vbo = 0;
+	instance_format = -1;
+	instance_count = 0;
+	gpu_capacity = gpu_count = 0;
+	ibo_bytes = instance_bytes = 0;
+	all_dirty = indices_dirty = true;
+}
+
+
+//Streaming meshes are rebuilt every frame anyway and one still uploading
+//has nothing to give back yet.  Instance data only lives in instance_vbo,
+//a restored mesh would draw every instance with the default attributes.
+template<class Vertex, class Alloc>
+bool Mesh<Vertex, Alloc>::evict()
+{
+	if (streaming || uploading || !vao || instance_vbo || (verts.empty() && !reload))
+		return false;
+
+	release_gl();
+	return true;
+}
+
+
+//Uploads again what prepare() already built, nothing is recomputed
+template<class Vertex, class Alloc>
+bool Mesh<Vertex, Alloc>::restore()
+{
+	if (!verts.empty())
+		upload();
+	else if (!reload || !reload(*this))
+		return false;
+	return !evicted;
+}
+
+
+//for the draw calls: back from eviction, upload landed, mark as used
+template<class Vertex, class Alloc>
+bool Mesh<Vertex, Alloc>::ready()
+{
+	if (evicted && !restore())
+		return false;
+	if (!resident())
+		return false;
+	touch();
+	return true;
+}
+
+
+//Only reallocates when verts outgrew the buffer (leaving half again as much
+//room), otherwise uploads the coalesced dirty ranges plus anything appended.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::upload_vertices()
+{
+	const size_t stride = gpu_vertex<Vertex>::stride;
+	size_t n = verts.size();
+
+	if (n > gpu_count)
+		mark_dirty(gpu_count, n - gpu_count);
+
+	if (n > gpu_capacity) {
+		gpu_capacity = gpu_capacity ? n + n/2 : n;
+		glBufferData(GL_ARRAY_BUFFER, stride*gpu_capacity, NULL, GL_STATIC_DRAW);
+		all_dirty = true;
+	}
+
+	if (all_dirty) {
+		upload_range(0, n);
+	} else {
+		coalesce_ranges(dirty, 4096 / stride);
+		for (size_t i=0; i<dirty.size(); ++i) {
+			size_t last = (dirty[i].last < n) ? dirty[i].last : n;
+			if (dirty[i].first < last)
+				upload_range(dirty[i].first, last - dirty[i].first);
+		}
+	}
+
+	dirty.clear();
+	all_dirty = false;
+	gpu_count = n;
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::upload_range(size_t first, size_t count)
+{
+	const size_t stride = gpu_vertex<Vertex>::stride;
+	if (!count)
+		return;
+
+	if (!layout::packed) {
+		glBufferSubData(GL_ARRAY_BUFFER, stride*first, stride*count, &verts[first]);
+		return;
+	}
+
+	std::vector<unsigned char> packed(stride*count);
+	gpu_vertex<Vertex>::pack(&verts[first], count, &packed[0], quant);
+	glBufferSubData(GL_ARRAY_BUFFER, stride*first, stride*count, &packed[0]);
+}
+
+
+//Only when something may have moved: the dirty tracking upload_vertices()
+//uses, which end() hasn't cleared yet at this point.  Streaming meshes are
+//all_dirty every frame, mapped ones have nothing in verts to look at.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::update_bounds()
+{
+	if (stream_mapped)
+		return;
+	if (!all_dirty && dirty.empty() && verts.size() == gpu_count)
+		return;
+
+	compute_bounds(bounds, verts.empty() ? NULL : &verts[0], verts.size(), sizeof(Vertex),
+	               layout::offset_of(ATTRIBUTE_VERTEX), bounds_threads);
+}
+
+
+//The box only has to contain every position.  While the bounds (current,
+//see update_bounds()) stay inside it nothing else needs repacking, once
+//they don't everything does.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::update_quant_box()
+{
+	if (!all_dirty) {
+		glm::vec3 box_max = quant.min + quant.extent;
+		if (bounds.min.x >= quant.min.x && bounds.min.y >= quant.min.y && bounds.min.z >= quant.min.z &&
+		    bounds.max.x <= box_max.x && bounds.max.y <= box_max.y && bounds.max.z <= box_max.z)
+			return;
+	}
+
+	set_quant_box(quant, bounds.min, bounds.max);
+	all_dirty = true;
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::set_instances(const GLFrame* frames, size_t count, int format, const float* scales)
+{
+	if (format == INSTANCE_COMPACT) {
+		std::vector<glm::vec4> data(count*2);
+		pack_instance_compact(frames, count, scales, &data[0]);
+		upload_instances(&data[0], sizeof(glm::vec4)*data.size(), count, format);
+	} else {
+		std::vector<glm::mat4> data(count);
+		pack_instance_matrices(frames, count, &data[0]);
+		upload_instances(&data[0], sizeof(glm::mat4)*count, count, format);
+	}
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::set_instances(const glm::mat4* models, size_t count)
+{
+	upload_instances(models, sizeof(glm::mat4)*count, count, INSTANCE_MATRIX);
+}
+
+
+//The instance buffer is orphaned on every upload since it's normally
+//rewritten each frame.  The attribute setup only changes with the format.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::upload_instances(const void* data, size_t bytes, size_t count, int format)
+{
+	if (evicted)
+		restore();
+
+	glBindVertexArray(vao);
+	if (!instance_vbo)
+		glGenBuffers(1, &instance_vbo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);
+
+	if (format != instance_format) {
+		int locs = (format == INSTANCE_COMPACT) ? 2 : 4;
+		for (int i=0; i<4; ++i) {
+			if (i < locs) {
+				glEnableVertexAttribArray(ATTRIBUTE_INSTANCE+i);
+				glVertexAttribPointer(ATTRIBUTE_INSTANCE+i, 4, GL_FLOAT, GL_FALSE, locs*sizeof(glm::vec4), (const GLvoid*)(i*sizeof(glm::vec4)));
+				glVertexAttribDivisor(ATTRIBUTE_INSTANCE+i, 1);
+			} else {
+				glDisableVertexAttribArray(ATTRIBUTE_INSTANCE+i);
+			}
+		}
+		instance_format = format;
+	}
+
+	glBindVertexArray(0);
+	instance_count = count;
+
+	if (bytes != instance_bytes) {
+		instance_bytes = bytes;
+		update_gpu_size();
+	}
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::end(const void* gpu_verts, size_t vcount, const void* gpu_indices, size_t icount, GLenum itype)
+{
+	const size_t stride = gpu_vertex<Vertex>::stride;
+
+	//none of it describes the new buffers
+	vertex_vector(verts.get_allocator()).swap(verts);
+	std::vector<GLuint>().swap(indices);
+	std::vector<GLuint>().swap(strip_indices);
+	std::vector<GLuint>().swap(lod_indices);
+	std::vector<Meshlet>().swap(meshlets);
+	lods.clear();
+
+	if (!vao) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		gpu_vertex<Vertex>::setup();
+	} else {
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	}
+
+	glBufferData(GL_ARRAY_BUFFER, stride*vcount, gpu_verts, GL_STATIC_DRAW);
+	gpu_capacity = gpu_count = vcount;
+
+	indexed = gpu_indices != NULL;
+	if (indexed) {
+		if (!ibo)
+			glGenBuffers(1, &ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+		index_type = itype;
+		size_t isize = (itype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, isize*icount, gpu_indices, GL_STATIC_DRAW);
+		ibo_bytes = isize*icount;
+	}
+
+	glBindVertexArray(0);
+
+	draw_count = indexed ? icount : vcount;
+	base_vertex = 0;
+	index_offset = 0;
+	dirty.clear();
+	all_dirty = indices_dirty = false;
+	update_gpu_size();
+}
+
+
+//Grows the ring (by at least half) when bytes doesn't fit in a region,
+//otherwise just moves on to the next region.  A new buffer means the VAO
+//has to be pointed at it again.
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::reserve_stream(StreamBuffer& stream, GLenum target, size_t bytes, size_t granularity)
+{
+	if (stream.buffer && bytes <= stream.region_size) {
+		stream.advance();
+		return;
+	}
+
+	size_t size = stream.region_size + stream.region_size/2;
+	if (size < bytes)
+		size = bytes;
+	size = (size + granularity-1) / granularity * granularity;
+	if (!size)
+		size = granularity;	//no zero sized storage for an empty first frame
+
+	glBindVertexArray(vao);
+	stream.init(target, size);
+	if (target == GL_ARRAY_BUFFER) {
+		vbo = stream.buffer;
+		gpu_vertex<Vertex>::setup();
+	} else {
+		ibo = stream.buffer;
+	}
+	glBindVertexArray(0);
+}
+
+
+template<class Vertex, class Alloc>
+void* Mesh<Vertex, Alloc>::map_stream(size_t count)
+{
+	const size_t stride = gpu_vertex<Vertex>::stride;
+
+	if (!vao)
+		glGenVertexArrays(1, &vao);
+
+	//regions are a multiple of the vertex size so base_vertex is exact
+	reserve_stream(vstream, GL_ARRAY_BUFFER, count*stride, stride*4);
+
+	size_t offset;
+	void* p = vstream.map(count*stride, stride, &offset);
+	base_vertex = offset / stride;
+	draw_count = count;
+	stream_mapped = true;
+	return p;
+}
+
+
+template<class Vertex, class Alloc>
+Vertex* Mesh<Vertex, Alloc>::map_vertices(size_t count)
+{
+	static_assert(!layout::packed, "map_vertices() needs an unpacked vertex layout, fill verts instead");
+
+	return (Vertex*)map_stream(count);
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::end_stream()
+{
+	if (!stream_mapped) {
+		void* p = map_stream(verts.size());
+		if (verts.empty()) {
+			//only the map to undo
+		} else if (layout::packed) {
+			if (layout::needs_box) {
+				all_dirty = true;
+				update_quant_box();
+			}
+			gpu_vertex<Vertex>::pack(&verts[0], verts.size(), (unsigned char*)p, quant);
+		} else {
+			memcpy(p, &verts[0], sizeof(Vertex)*verts.size());
+		}
+	}
+	vstream.unmap();
+	stream_mapped = false;
+
+	if (!indexed)
+		return;
+
+	//indices are relative to base_vertex so 16 bits go as far as in a static mesh
+	size_t vertex_count = draw_count;
+	index_type = (vertex_count <= 0xFFFF) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	size_t isize = (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+
+	glBindVertexArray(vao);
+	reserve_stream(istream, GL_ELEMENT_ARRAY_BUFFER, indices.size()*isize, sizeof(GLuint));
+	glBindVertexArray(vao);
+
+	void* p = istream.map(indices.size()*isize, sizeof(GLuint), &index_offset);
+	if (index_type == GL_UNSIGNED_SHORT) {
+		GLushort* s = (GLushort*)p;
+		for (size_t i=0; i<indices.size(); ++i)
+			s[i] = indices[i];
+	} else if (!indices.empty()) {
+		memcpy(p, &indices[0], sizeof(GLuint)*indices.size());
+	}
+	istream.unmap();
+	glBindVertexArray(0);
+
+	draw_count = indices.size();
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::draw()
+{
+	if (!ready())
+		return;
+
+	glBindVertexArray(vao);
+	if (stripped) {
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		glDrawElementsBaseVertex(GL_TRIANGLE_STRIP, draw_count, index_type, (const GLvoid*)index_offset, base_vertex);
+		glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+	} else if (indexed) {
+		glDrawElementsBaseVertex(primitive, draw_count, index_type, (const GLvoid*)index_offset, base_vertex);
+	} else {
+		glDrawArrays(primitive, base_vertex, draw_count);
+	}
+	glBindVertexArray(0);
+
+}
+
+
+template<class Vertex, class Alloc>
+GLsizei Mesh<Vertex, Alloc>::draw_clusters(const glm::vec4* planes, const glm::mat4& model, const glm::vec3& camera)
+{
+	if (!ready())
+		return 0;
+
+	if (meshlets.empty()) {
+		draw();
+		return draw_count / 3;
+	}
+
+	visible_meshlets.resize(meshlets.size());
+	size_t n = cull_meshlets(&meshlets[0], meshlets.size(), planes, model, camera, &visible_meshlets[0]);
+
+	//neighbors in the index buffer become one draw
+	size_t isize = (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+	cluster_counts.clear();
+	cluster_offsets.clear();
+	GLsizei tris = 0;
+	GLuint next = ~0u;
+	for (size_t i=0; i<n; ++i) {
+		const Meshlet& m = meshlets[visible_meshlets[i]];
+		if (m.first_index == next) {
+			cluster_counts.back() += m.triangle_count*3;
+		} else {
+			cluster_counts.push_back(m.triangle_count*3);
+			cluster_offsets.push_back((const GLvoid*)(index_offset + m.first_index*isize));
+		}
+		next = m.first_index + m.triangle_count*3;
+		tris += m.triangle_count;
+	}
+
+	if (!cluster_counts.empty()) {
+		glBindVertexArray(vao);
+		glMultiDrawElements(primitive, &cluster_counts[0], index_type, &cluster_offsets[0], cluster_counts.size());
+		glBindVertexArray(0);
+	}
+	return tris;
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::build_lods()
+{
+	size_t pos_offset = layout::offset_of(ATTRIBUTE_VERTEX);
+
+	lods.clear();
+	lod_indices.clear();
+	MeshLod base = { 0, (GLuint)indices.size(), 0.0f };
+	lods.push_back(base);
+
+	//every level is simplified from the full mesh so its error is absolute
+	std::vector<GLuint> tmp(indices.size());
+	float target = indices.size();
+	for (GLuint i=0; i<lod_levels; ++i) {
+		target *= lod_ratio;
+		size_t target_count = (size_t)target - (size_t)target % 3;
+
+		float error;
+		size_t count = simplify_mesh(&tmp[0], &indices[0], indices.size(), &verts[0], verts.size(),
+		                             sizeof(Vertex), pos_offset, target_count, &error);
+
+		//stuck (everything left is locked), more levels would be the same.
+		//count - count/10 so a big GLuint count can't overflow the 90%
+		size_t prev = lods.back().index_count;
+		if (!count || count > prev - prev/10)
+			break;
+
+		if (optimize_cache)
+			optimize_vertex_cache(&tmp[0], count, verts.size());
+
+		MeshLod lod = { (GLuint)(indices.size() + lod_indices.size()), (GLuint)count, error };
+		if (lod.error < lods.back().error)
+			lod.error = lods.back().error;
+		lods.push_back(lod);
+		lod_indices.insert(lod_indices.end(), tmp.begin(), tmp.begin() + count);
+	}
+}
+
+
+template<class Vertex, class Alloc>
+int Mesh<Vertex, Alloc>::select_lod(const glm::vec3& camera, const glm::mat4& proj, const glm::mat4& model,
+                             float viewport_height, float pixel_error) const
+{
+	if (lods.size() < 2)
+		return 0;
+
+	float scale = 0.0f;
+	for (int i=0; i<3; ++i) {
+		float s = glm::length(glm::vec3(model[i]));
+		if (s > scale)
+			scale = s;
+	}
+
+	//pixels per model unit at the nearest point of the bounding sphere
+	float pixels = proj[1][1] * viewport_height * 0.5f * scale;
+	if (proj[2][3] != 0.0f) {
+		glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+		float dist = glm::length(center - camera) - bounds.radius * scale;
+		if (dist <= 0.0f)
+			return 0;
+		pixels /= dist;
+	}
+
+	int lod = 0;
+	for (size_t i=1; i<lods.size() && lods[i].error * pixels <= pixel_error; ++i)
+		lod = i;
+	return lod;
+}
+
+
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::draw_lod(int lod)
+{
+	if (!ready())
+		return;
+
+	if (lod <= 0 || (size_t)lod >= lods.size()) {
+		draw();
+		return;
+	}
+
+	size_t isize = (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+	glBindVertexArray(vao);
+	glDrawElementsBaseVertex(primitive, lods[lod].index_count, index_type,
+	                         (const GLvoid*)(index_offset + lods[lod].first_index*isize), base_vertex);
+	glBindVertexArray(0);
+}
+
+
+//count is normally instance_count, fewer draws only the first count
+template<class Vertex, class Alloc>
+void Mesh<Vertex, Alloc>::draw_instanced(GLsizei count)
+{
+	if (!ready())
+		return;
+
+	glBindVertexArray(vao);
+	if (stripped) {
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLE_STRIP, draw_count, index_type, (const GLvoid*)index_offset, count, base_vertex);
+		glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+	} else if (indexed) {
+		glDrawElementsInstancedBaseVertex(primitive, draw_count, index_type, (const GLvoid*)index_offset, count, base_vertex);
+	} else {
+		glDrawArraysInstanced(primitive, base_vertex, draw_count, count);
+	}
+	glBindVertexArray(0);
+}
+
+
 
 
 #endif
@@ -0,0 +1,301 @@
+/*
+ *Many small meshes in one buffer, drawn with multi draw indirect
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESHBATCH_H
+#define MESHBATCH_H
+
+#include <vector>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "Mesh.h"
+#include "stream_buffer.h"
+
+
+//layouts fixed by GL_ARB_draw_indirect
+struct DrawArraysIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first;
+	GLuint base_instance;
+};
+
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint  base_vertex;
+	GLuint base_instance;
+};
+
+
+//where one added mesh lives in the shared buffers
+struct BatchEntry
+{
+	GLuint first_vertex;
+	GLuint vertex_count;
+	GLuint first_index;
+	GLuint index_count;
+};
+
+
+//Every mesh added is appended to one vertex buffer (and one index buffer if
+//the batch is indexed) behind a single VAO.  draw() submits all of them with
+//one glMultiDraw*Indirect, draw(ids, n) any subset through a streamed
+//command buffer.  Indices stay relative to each mesh's first vertex and are
+//offset with base_vertex, so 16 bit indices work as long as no single mesh
+//has more than 65535 vertices.
+template<class Vertex = glm::vec3>
+class MeshBatch
+{
+public:
+	typedef typename vertex_format<Vertex>::layout layout;
+
+	std::vector<Vertex> verts;
+	std::vector<GLuint> indices;
+	std::vector<BatchEntry> entries;
+
+	GLenum primitive;
+	bool indexed;
+	GLenum index_type;
+
+	GLuint vao, vbo, ibo;
+	GLuint indirect;		//commands for every entry, built in end()
+	StreamBuffer commands;		//per call commands for draw(ids, n)
+
+	QuantBox quant;			//shared by every mesh for VF_UNORM16_BOX layouts
+
+	MeshBatch(GLenum p = GL_TRIANGLES, bool indexed = true)
+	{
+		primitive = p;
+		this->indexed = indexed;
+		index_type = GL_UNSIGNED_INT;
+		vao = vbo = ibo = indirect = 0;
+		set_quant_box(quant, glm::vec3(0.0f), glm::vec3(1.0f));
+	}
+
+	~MeshBatch()
+	{
+		if (vao) {
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ibo);
+			glDeleteBuffers(1, &indirect);
+		}
+	}
+
+	//Copies mesh's vertices (and indices, a non indexed mesh gets 0..n-1) and
+	//returns the id to pass to draw().  Weld/optimize the mesh first if wanted.
+	template<class Alloc>
+	unsigned int add(const Mesh<Vertex, Alloc>& mesh)
+	{
+		return add(mesh.verts.empty() ? NULL : &mesh.verts[0], mesh.verts.size(),
+		           mesh.indices.empty() ? NULL : &mesh.indices[0], mesh.indices.size());
+	}
+
+	unsigned int add(const Vertex* v, size_t vcount, const GLuint* idx, size_t icount);
+
+	void clear() { verts.clear(); indices.clear(); entries.clear(); }
+
+	void end();
+	void draw();
+	void draw(const unsigned int* ids, size_t count);
+
+private:
+	MeshBatch(const MeshBatch&);
+	MeshBatch& operator=(const MeshBatch&);
+
+	void fill_command(void* out, const BatchEntry& e);
+	void submit(const void* offset, GLsizei count);
+};
+
+
+template<class Vertex>
+unsigned int MeshBatch<Vertex>::add(const Vertex* v, size_t vcount, const GLuint* idx, size_t icount)
+{
+	BatchEntry e;
+	e.first_vertex = verts.size();
+	e.vertex_count = vcount;
+	e.first_index = indices.size();
+	e.index_count = 0;
+
+	verts.insert(verts.end(), v, v + vcount);
+
+	if (indexed) {
+		if (idx) {
+			indices.insert(indices.end(), idx, idx + icount);
+			e.index_count = icount;
+		} else {
+			for (size_t i=0; i<vcount; ++i)
+				indices.push_back(i);
+			e.index_count = vcount;
+		}
+	}
+
+	entries.push_back(e);
+	return entries.size() - 1;
+}
+
+
+template<class Vertex>
+void MeshBatch<Vertex>::fill_command(void* out, const BatchEntry& e)
+{
+	if (indexed) {
+		DrawElementsIndirectCommand* cmd = (DrawElementsIndirectCommand*)out;
+		cmd->count = e.index_count;
+		cmd->instance_count = 1;
+		cmd->first_index = e.first_index;
+		cmd->base_vertex = e.first_vertex;
+		cmd->base_instance = 0;
+	} else {
+		DrawArraysIndirectCommand* cmd = (DrawArraysIndirectCommand*)out;
+		cmd->count = e.vertex_count;
+		cmd->instance_count = 1;
+		cmd->first = e.first_vertex;
+		cmd->base_instance = 0;
+	}
+}
+
+
+template<class Vertex>
+void MeshBatch<Vertex>::end()
+{
+	if (!vao) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		gpu_vertex<Vertex>::setup();
+
+		glGenBuffers(1, &ibo);
+		glGenBuffers(1, &indirect);
+	} else {
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	}
+
+	if (layout::packed) {
+		//one box for the whole batch
+		if (layout::needs_box) {
+			glm::vec3 min, max;
+			compute_box(verts.empty() ? NULL : &verts[0], verts.size(), sizeof(Vertex),
+			            layout::offset_of(ATTRIBUTE_VERTEX), min, max);
+			set_quant_box(quant, min, max);
+		}
+
+		std::vector<unsigned char> packed(gpu_vertex<Vertex>::stride * verts.size());
+		if (!verts.empty())
+			gpu_vertex<Vertex>::pack(&verts[0], verts.size(), &packed[0], quant);
+		glBufferData(GL_ARRAY_BUFFER, packed.size(), packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex)*verts.size(), verts.empty() ? NULL : &verts[0], GL_STATIC_DRAW);
+	}
+
+	if (indexed) {
+		index_type = GL_UNSIGNED_SHORT;
+		for (size_t i=0; i<entries.size(); ++i) {
+			if (entries[i].vertex_count > 0xFFFF) {
+				index_type = GL_UNSIGNED_INT;
+				break;
+			}
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		if (index_type == GL_UNSIGNED_SHORT) {
+			std::vector<GLushort> short_indices(indices.begin(), indices.end());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*short_indices.size(),
+			             short_indices.empty() ? NULL : &short_indices[0], GL_STATIC_DRAW);
+		} else {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(),
+			             indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+		}
+	}
+
+	glBindVertexArray(0);
+
+	//the draw everything command list never changes
+	size_t cmd_size = indexed ? sizeof(DrawElementsIndirectCommand) : sizeof(DrawArraysIndirectCommand);
+	std::vector<unsigned char> cmds(cmd_size * entries.size());
+	for (size_t i=0; i<entries.size(); ++i)
+		fill_command(&cmds[i*cmd_size], entries[i]);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, cmds.size(), cmds.empty() ? NULL : &cmds[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+
+//offset is into whatever is bound to GL_DRAW_INDIRECT_BUFFER
+template<class Vertex>
+void MeshBatch<Vertex>::submit(const void* offset, GLsizei count)
+{
+	if (GLEW_ARB_multi_draw_indirect) {
+		if (indexed)
+			glMultiDrawElementsIndirect(primitive, index_type, offset, count, 0);
+		else
+			glMultiDrawArraysIndirect(primitive, offset, count, 0);
+		return;
+	}
+
+	//GL 4.0 has the single draw indirect calls at least
+	size_t cmd_size = indexed ? sizeof(DrawElementsIndirectCommand) : sizeof(DrawArraysIndirectCommand);
+	for (GLsizei i=0; i<count; ++i) {
+		const char* cmd = (const char*)offset + i*cmd_size;
+		if (indexed)
+			glDrawElementsIndirect(primitive, index_type, cmd);
+		else
+			glDrawArraysIndirect(primitive, cmd);
+	}
+}
+
+
+template<class Vertex>
+void MeshBatch<Vertex>::draw()
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect);
+	submit(0, entries.size());
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+
+template<class Vertex>
+void MeshBatch<Vertex>::draw(const unsigned int* ids, size_t count)
+{
+	if (!count)
+		return;
+
+	size_t cmd_size = indexed ? sizeof(DrawElementsIndirectCommand) : sizeof(DrawArraysIndirectCommand);
+	size_t bytes = cmd_size * count;
+
+	//room for a few full batches per region, the ring moves on when one fills up
+	if (!commands.buffer || bytes > commands.region_size)
+		commands.init(GL_DRAW_INDIRECT_BUFFER, cmd_size * entries.size() * 4 > bytes ? cmd_size * entries.size() * 4 : bytes);
+
+	size_t offset;
+	void* p = commands.map(bytes, sizeof(GLuint), &offset);
+	if (!p) {
+		commands.advance();
+		p = commands.map(bytes, sizeof(GLuint), &offset);
+	}
+
+	for (size_t i=0; i<count; ++i)
+		fill_command((char*)p + i*cmd_size, entries[ids[i]]);
+	commands.unmap();
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+	submit((const void*)offset, count);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+
+#endif
+
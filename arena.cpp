@@ -0,0 +1,89 @@
+/*
+ *Monotonic arena and an allocator for putting std::vectors in it
+ *BSD license (see LICENSE)
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <new>
+
+
+Arena::Arena(size_t block_size)
+{
+	first = current = NULL;
+	offset = 0;
+	this->block_size = block_size;
+	used_bytes = reserved_bytes = 0;
+}
+
+Arena::~Arena()
+{
+	release();
+}
+
+
+bool Arena::fits(const Block* b, size_t off, size_t bytes, size_t align) const
+{
+	size_t start = ((size_t)data((Block*)b) + off + align-1) & ~(align-1);
+	return start + bytes <= (size_t)data((Block*)b) + b->size;
+}
+
+
+//Moves on to the next kept block big enough, or links a new one in after
+//current, when current is full.  Blocks skipped stay in the list for the
+//next frame.
+void* Arena::allocate(size_t bytes, size_t align)
+{
+	if (!current || !fits(current, offset, bytes, align)) {
+		Block* b = current ? current->next : first;
+		while (b && !fits(b, 0, bytes, align))
+			b = b->next;
+
+		if (!b) {
+			size_t size = bytes + align > block_size ? bytes + align : block_size;
+			b = (Block*)malloc(sizeof(Block) + size);
+			if (!b)
+				throw std::bad_alloc();
+			b->size = size;
+			reserved_bytes += size;
+			if (current) {
+				b->next = current->next;
+				current->next = b;
+			} else {
+				b->next = first;
+				first = b;
+			}
+		}
+		current = b;
+		offset = 0;
+	}
+
+	size_t base = (size_t)data(current);
+	size_t start = (base + offset + align-1) & ~(align-1);
+	offset = start + bytes - base;
+	used_bytes += bytes;
+	return (void*)start;
+}
+
+
+void Arena::reset()
+{
+	current = first;
+	offset = 0;
+	used_bytes = 0;
+}
+
+
+void Arena::release()
+{
+	while (first) {
+		Block* next = first->next;
+		free(first);
+		first = next;
+	}
+	current = NULL;
+	offset = 0;
+	used_bytes = reserved_bytes = 0;
+}
+
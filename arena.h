@@ -0,0 +1,77 @@
+/*
+ *Monotonic arena and an allocator for putting std::vectors in it
+ *BSD license (see LICENSE)
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+
+//Hands out memory from big blocks and never frees individual allocations.
+//reset() makes every block available again without freeing anything (it
+//just rewinds), so per frame data built in an arena goes away in O(1).
+//Everything allocated from it must be dead (or cleared and never touched
+//again) before reset().
+class Arena
+{
+public:
+	Arena(size_t block_size = 1 << 20);
+	~Arena();
+
+	void* allocate(size_t bytes, size_t align);
+	void reset();
+	void release();		//frees the blocks too
+
+	size_t used() const { return used_bytes; }		//since the last reset()
+	size_t reserved() const { return reserved_bytes; }	//held in blocks
+
+private:
+	struct Block
+	{
+		Block* next;
+		size_t size;
+	};
+
+	Block* first;
+	Block* current;
+	size_t offset;			//into current's data
+	size_t block_size;
+	size_t used_bytes, reserved_bytes;
+
+	bool fits(const Block* b, size_t off, size_t bytes, size_t align) const;
+	static unsigned char* data(Block* b) { return (unsigned char*)(b + 1); }
+
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+};
+
+
+//Stateful allocator over an Arena, eg
+//Mesh<Vertex_PC, ArenaAllocator<Vertex_PC> > debug(GL_LINES, frame_arena);
+//deallocate() does nothing so reserve() up front when the size is known,
+//outgrown buffers stay in the arena until the reset().
+template<class T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	Arena* arena;
+
+	ArenaAllocator(Arena& a) : arena(&a) {}
+	template<class U> ArenaAllocator(const ArenaAllocator<U>& a) : arena(a.arena) {}
+
+	T* allocate(size_t n) { return (T*)arena->allocate(n*sizeof(T), alignof(T)); }
+	void deallocate(T*, size_t) {}
+};
+
+template<class T, class U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+
+template<class T, class U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+
+#endif
+
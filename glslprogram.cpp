@@ -9,19 +9,33 @@ using std::ios;
 #include <sstream>
 using std::ostringstream;
 
-#include <sys/stat.h>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-GLSLProgram::GLSLProgram() : handle(0), linked(false) { }
+string GLSLProgram::binaryCacheDir;
+int GLSLProgram::currentProgram = -1;
+GLSLStateStats GLSLProgram::stateStats;
+
+GLSLProgram::GLSLProgram() : handle(0), linked(false), uniformMask(0), fromBinaryCache(false) { }
 
 bool GLSLProgram::compileShaderFromFile( const char * fileName,
                                          GLSLShader::GLSLShaderType type )
 {
-    if( ! fileExists(fileName) )
-    {
-        logString = "File not found.";
+    string code;
+    if( !readShaderFile(fileName, code, &logString) ) {
         return false;
     }
 
+    return addSource(code, type);
+}
+
+bool GLSLProgram::createHandle()
+{
     if( handle <= 0 ) {
         handle = glCreateProgram();
         if( handle == 0) {
@@ -29,36 +43,44 @@ bool GLSLProgram::compileShaderFromFile( const char * fileName,
             return false;
         }
     }
+    return true;
+}
 
-    ifstream inFile( fileName, ios::in );
-    if( !inFile ) {
+bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GLSLShaderType type )
+{
+    string code;
+    if( !preprocessShader(source, "", code, &logString) ) {
         return false;
     }
 
-    ostringstream code;
-	//this right here is not good it reads EOF into the source in linux
-	
-	int c = inFile.get();
-    while( inFile.good() ) {
-        code << (char) c;
-		c = inFile.get();
-	}
-    inFile.close();
+    return addSource(code, type);
+}
+
+// source has its #includes expanded already
+bool GLSLProgram::addSource( const string & source, GLSLShader::GLSLShaderType type )
+{
+    if( !createHandle() ) return false;
 
+    if( binaryCacheEnabled() ) {
+        GLSLShaderSource shader = { type, source };
+        pending.push_back(shader);
+        return true;
+    }
 
-    return compileShaderFromString(code.str(), type);
+    return compileShader(source, type);
 }
 
-bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GLSLShaderType type )
+bool GLSLProgram::compileShader( const string & source, GLSLShader::GLSLShaderType type )
 {
-    if( handle <= 0 ) {
-        handle = glCreateProgram();
-        if( handle == 0) {
-            logString = "Unable to create shader program.";
-            return false;
-        }
-    }
+    GLuint shaderHandle = startCompile(source, type);
+    if( !shaderHandle ) return false;
+    return finishCompile(shaderHandle);
+}
 
+// Hands the source to the compiler without asking for the result, so with
+// parallel shader compile it builds in the background
+GLuint GLSLProgram::startCompile( const string & source, GLSLShader::GLSLShaderType type )
+{
     GLuint shaderHandle = 0;
 
     switch( type ) {
@@ -78,7 +100,7 @@ bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GL
         shaderHandle = glCreateShader(GL_TESS_EVALUATION_SHADER);
         break;
     default:
-        return false;
+        return 0;
     }
 
 	
@@ -89,7 +111,13 @@ bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GL
 
     // Compile the shader
     glCompileShader(shaderHandle );
+    return shaderHandle;
+}
 
+// Waits for the compile if it isn't done, attaches the shader on success.
+// The shader is flagged for deletion either way.
+bool GLSLProgram::finishCompile( GLuint shaderHandle )
+{
     // Check for errors
     int result;
     glGetShaderiv( shaderHandle, GL_COMPILE_STATUS, &result );
@@ -106,6 +134,7 @@ bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GL
             delete [] c_log;
         }
 
+        glDeleteShader(shaderHandle);
         return false;
     } else {
         // Compile succeeded, attach shader and return true
@@ -122,13 +151,53 @@ bool GLSLProgram::compileShaderFromString( const string & source, GLSLShader::GL
     }
 }
 
+// With the binary cache on, a cached binary is tried first.  If there isn't
+// one, or the driver rejects it, the sources are compiled and linked as
+// usual and the result saved for next time.  Compile errors show up here
+// rather than in compileShaderFromString() then.
 bool GLSLProgram::link()
 {
     if( linked ) return true;
     if( handle <= 0 ) return false;
 
+    if( !pending.empty() ) {
+        if( binaryCacheEnabled() && loadCachedBinary() )
+            return finishLink();
+
+        for( size_t i = 0; i < pending.size(); ++i ) {
+            if( !compileShader(pending[i].source, pending[i].type) ) {
+                pending.clear();
+                return false;
+            }
+        }
+        pending.clear();
+    }
+
+    startLink();
+    return finishLink();
+}
+
+// Tries the binary cache for the pending sources, remembering the file so
+// a source build can save to it
+bool GLSLProgram::loadCachedBinary()
+{
+    binaryFile = binaryCacheFile();
+    if( !loadBinary(binaryFile) ) return false;
+
+    pending.clear();
+    fromBinaryCache = true;
+    return true;
+}
+
+void GLSLProgram::startLink()
+{
+    if( !binaryFile.empty() )
+        glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(handle);
+}
 
+bool GLSLProgram::finishLink()
+{
     int status = 0;
     glGetProgramiv( handle, GL_LINK_STATUS, &status);
     if( GL_FALSE == status ) {
@@ -149,6 +218,10 @@ bool GLSLProgram::link()
         return false;
     } else {
         linked = true;
+        if( !binaryFile.empty() && !fromBinaryCache )
+            saveBinary(binaryFile);
+        binaryFile.clear();
+        cacheUniforms();
         return linked;
     }
 }
@@ -156,7 +229,13 @@ bool GLSLProgram::link()
 void GLSLProgram::use()
 {
     if( handle <= 0 || (! linked) ) return;
+    if( currentProgram == handle ) {
+        stateStats.usesSkipped++;
+        return;
+    }
     glUseProgram( handle );
+    currentProgram = handle;
+    stateStats.useCalls++;
 }
 
 string GLSLProgram::log()
@@ -174,21 +253,38 @@ bool GLSLProgram::isLinked()
     return linked;
 }
 
+bool GLSLProgram::isFromBinaryCache()
+{
+    return fromBinaryCache;
+}
+
 void GLSLProgram::bindAttribLocation( GLuint location, const char * name)
 {
+    if( !createHandle() ) return;
     glBindAttribLocation(handle, location, name);
+
+    ostringstream b;
+    b << "attrib " << location << ' ' << name << '\n';
+    bindings += b.str();
 }
 
 void GLSLProgram::bindFragDataLocation( GLuint location, const char * name )
 {
+    if( !createHandle() ) return;
     glBindFragDataLocation(handle, location, name);
+
+    ostringstream b;
+    b << "frag " << location << ' ' << name << '\n';
+    bindings += b.str();
 }
 
 void GLSLProgram::setUniform( const char *name, float x, float y, float z)
 {
     int loc = getUniformLocation(name);
     if( loc >= 0 ) {
-        glUniform3f(loc,x,y,z);
+        float v[3] = { x, y, z };
+        if( uniformChanged(loc, v, sizeof(v)) )
+            glUniform3f(loc,x,y,z);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -203,7 +299,8 @@ void GLSLProgram::setUniform( const char *name, const vec4 & v)
 {
     int loc = getUniformLocation(name);
     if( loc >= 0 ) {
-        glUniform4f(loc,v.x,v.y,v.z,v.w);
+        if( uniformChanged(loc, &v, sizeof(v)) )
+            glUniform4f(loc,v.x,v.y,v.z,v.w);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -214,7 +311,8 @@ void GLSLProgram::setUniform( const char *name, const mat4 & m)
     int loc = getUniformLocation(name);
     if( loc >= 0 )
     {
-        glUniformMatrix4fv(loc, 1, GL_FALSE, (GLfloat*)&m[0][0]);
+        if( uniformChanged(loc, &m, sizeof(m)) )
+            glUniformMatrix4fv(loc, 1, GL_FALSE, (GLfloat*)&m[0][0]);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -225,7 +323,8 @@ void GLSLProgram::setUniform( const char *name, const mat3 & m)
     int loc = getUniformLocation(name);
     if( loc >= 0 )
     {
-        glUniformMatrix3fv(loc, 1, GL_FALSE, (GLfloat*)&m[0][0]);
+        if( uniformChanged(loc, &m, sizeof(m)) )
+            glUniformMatrix3fv(loc, 1, GL_FALSE, (GLfloat*)&m[0][0]);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -236,7 +335,8 @@ void GLSLProgram::setUniform( const char *name, float val )
     int loc = getUniformLocation(name);
     if( loc >= 0 )
     {
-        glUniform1f(loc, val);
+        if( uniformChanged(loc, &val, sizeof(val)) )
+            glUniform1f(loc, val);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -247,7 +347,8 @@ void GLSLProgram::setUniform( const char *name, int val )
     int loc = getUniformLocation(name);
     if( loc >= 0 )
     {
-        glUniform1i(loc, val);
+        if( uniformChanged(loc, &val, sizeof(val)) )
+            glUniform1i(loc, val);
     } else {
         printf("Uniform: %s not found.\n",name);
     }
@@ -255,13 +356,93 @@ void GLSLProgram::setUniform( const char *name, int val )
 
 void GLSLProgram::setUniform( const char *name, bool val )
 {
-    int loc = getUniformLocation(name);
-    if( loc >= 0 )
-    {
-        glUniform1i(loc, val);
-    } else {
-        printf("Uniform: %s not found.\n",name);
+    this->setUniform(name, int(val));
+}
+
+// An invalid handle has location -1, which glUniform* silently ignores
+void GLSLProgram::setUniform( UniformHandle<float> h, float val )
+{
+    if( uniformChanged(h.getLocation(), &val, sizeof(val)) )
+        glUniform1f(h.getLocation(), val);
+}
+
+void GLSLProgram::setUniform( UniformHandle<int> h, int val )
+{
+    if( uniformChanged(h.getLocation(), &val, sizeof(val)) )
+        glUniform1i(h.getLocation(), val);
+}
+
+void GLSLProgram::setUniform( UniformHandle<bool> h, bool val )
+{
+    int i = val;
+    if( uniformChanged(h.getLocation(), &i, sizeof(i)) )
+        glUniform1i(h.getLocation(), i);
+}
+
+void GLSLProgram::setUniform( UniformHandle<vec2> h, const vec2 & v )
+{
+    if( uniformChanged(h.getLocation(), &v, sizeof(v)) )
+        glUniform2f(h.getLocation(), v.x, v.y);
+}
+
+void GLSLProgram::setUniform( UniformHandle<vec3> h, const vec3 & v )
+{
+    if( uniformChanged(h.getLocation(), &v, sizeof(v)) )
+        glUniform3f(h.getLocation(), v.x, v.y, v.z);
+}
+
+void GLSLProgram::setUniform( UniformHandle<vec4> h, const vec4 & v )
+{
+    if( uniformChanged(h.getLocation(), &v, sizeof(v)) )
+        glUniform4f(h.getLocation(), v.x, v.y, v.z, v.w);
+}
+
+void GLSLProgram::setUniform( UniformHandle<mat3> h, const mat3 & m )
+{
+    if( uniformChanged(h.getLocation(), &m, sizeof(m)) )
+        glUniformMatrix3fv(h.getLocation(), 1, GL_FALSE, (GLfloat*)&m[0][0]);
+}
+
+void GLSLProgram::setUniform( UniformHandle<mat4> h, const mat4 & m )
+{
+    if( uniformChanged(h.getLocation(), &m, sizeof(m)) )
+        glUniformMatrix4fv(h.getLocation(), 1, GL_FALSE, (GLfloat*)&m[0][0]);
+}
+
+// Compares with and updates the shadow copy.  Anything that can't be
+// shadowed (not the current program, a location outside the table) is
+// always sent.
+bool GLSLProgram::uniformChanged( int location, const void * value, unsigned int size )
+{
+    if( currentProgram != handle || location < 0 || location >= (int)shadows.size() ) {
+        stateStats.uniformCalls++;
+        return true;
     }
+
+    UniformShadow & s = shadows[location];
+    if( s.size == size && !memcmp(s.data, value, size) ) {
+        stateStats.uniformsSkipped++;
+        return false;
+    }
+    s.size = size;
+    memcpy(s.data, value, size);
+    stateStats.uniformCalls++;
+    return true;
+}
+
+void GLSLProgram::invalidateCurrent()
+{
+    currentProgram = -1;
+}
+
+GLSLStateStats GLSLProgram::getStateStats()
+{
+    return stateStats;
+}
+
+void GLSLProgram::resetStateStats()
+{
+    memset(&stateStats, 0, sizeof(stateStats));
 }
 
 void GLSLProgram::printActiveUniforms() {
@@ -338,18 +519,569 @@ bool GLSLProgram::validate()
     }
 }
 
+// FNV-1a
+static unsigned int hashName( const char * name )
+{
+    unsigned int h = 2166136261u;
+    for( ; *name; ++name ) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Samplers, images and atomic counters are set with glUniform1i
+static bool isOpaqueType( GLenum type )
+{
+    switch( type ) {
+    case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+    case GL_DOUBLE: case GL_DOUBLE_VEC2: case GL_DOUBLE_VEC3: case GL_DOUBLE_VEC4:
+    case GL_INT: case GL_INT_VEC2: case GL_INT_VEC3: case GL_INT_VEC4:
+    case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+    case GL_BOOL: case GL_BOOL_VEC2: case GL_BOOL_VEC3: case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+    case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT4x3:
+    case GL_DOUBLE_MAT2: case GL_DOUBLE_MAT3: case GL_DOUBLE_MAT4:
+    case GL_DOUBLE_MAT2x3: case GL_DOUBLE_MAT2x4: case GL_DOUBLE_MAT3x2:
+    case GL_DOUBLE_MAT3x4: case GL_DOUBLE_MAT4x2: case GL_DOUBLE_MAT4x3:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Called once the program is linked.  Arrays are reported as "name[0]", they
+// go in the table under that, the bare name and every "name[i]" so any of the
+// spellings glGetUniformLocation takes will hit.  Uniforms in blocks have no
+// location and are left out.
+void GLSLProgram::cacheUniforms()
+{
+    struct Active { string name; int location; GLenum type; };
+    std::vector<Active> active;
+
+    GLint nUniforms = 0, maxLen = 0;
+    glGetProgramiv( handle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLen);
+    glGetProgramiv( handle, GL_ACTIVE_UNIFORMS, &nUniforms);
+
+    std::vector<GLchar> name(maxLen + 1);
+    for( int i = 0; i < nUniforms; ++i ) {
+        GLint size;
+        GLenum type;
+        GLsizei written = 0;
+        glGetActiveUniform( handle, i, maxLen + 1, &written, &size, &type, &name[0] );
+
+        Active a = { string(&name[0], written), glGetUniformLocation(handle, &name[0]), type };
+        if( a.location < 0 )
+            continue;
+        active.push_back(a);
+
+        size_t len = a.name.size();
+        if( len > 3 && !a.name.compare(len-3, 3, "[0]") ) {
+            string base = a.name.substr(0, len-3);
+            a.name = base;
+            active.push_back(a);
+            for( int j = 1; j < size; ++j ) {
+                ostringstream element;
+                element << base << '[' << j << ']';
+                a.name = element.str();
+                a.location = glGetUniformLocation(handle, a.name.c_str());
+                active.push_back(a);
+            }
+        }
+    }
+
+    // at most half full
+    unsigned int tableSize = 16;
+    while( tableSize < active.size() * 2 )
+        tableSize *= 2;
+
+    uniforms.clear();
+    uniforms.resize(tableSize);
+    uniformMask = tableSize - 1;
+    int maxLocation = -1;
+    for( size_t i = 0; i < active.size(); ++i ) {
+        addUniform(active[i].name, active[i].location, active[i].type);
+        if( active[i].location > maxLocation )
+            maxLocation = active[i].location;
+    }
+
+    // linking resets every value, nothing is known until it's set
+    UniformShadow unknown;
+    unknown.size = 0;
+    shadows.assign(maxLocation + 1, unknown);
+}
+
+void GLSLProgram::addUniform( const string & name, int location, GLenum type )
+{
+    unsigned int h = hashName(name.c_str());
+    unsigned int i = h & uniformMask;
+    while( !uniforms[i].name.empty() ) {
+        if( uniforms[i].hash == h && uniforms[i].name == name )
+            return;
+        i = (i + 1) & uniformMask;
+    }
+
+    uniforms[i].hash = h;
+    uniforms[i].location = location;
+    uniforms[i].type = type;
+    uniforms[i].name = name;
+}
+
+const GLSLProgram::UniformEntry * GLSLProgram::findUniform( const char * name )
+{
+    if( uniforms.empty() ) return NULL;
+
+    unsigned int h = hashName(name);
+    for( unsigned int i = h & uniformMask; ; i = (i + 1) & uniformMask ) {
+        const UniformEntry & e = uniforms[i];
+        if( e.name.empty() )
+            return NULL;
+        if( e.hash == h && e.name == name )
+            return &e;
+    }
+}
+
 int GLSLProgram::getUniformLocation(const char * name )
 {
-    return glGetUniformLocation(handle, name);
+    const UniformEntry * e = findUniform(name);
+    return e ? e->location : -1;
+}
+
+int GLSLProgram::getUniformHandleLocation( const char * name, GLenum type )
+{
+    const UniformEntry * e = findUniform(name);
+    if( !e ) {
+        printf("Uniform: %s not found.\n",name);
+        return -1;
+    }
+
+    bool ok = e->type == type;
+    if( type == GL_INT )
+        ok = ok || e->type == GL_BOOL || isOpaqueType(e->type);
+    else if( type == GL_BOOL )
+        ok = ok || e->type == GL_INT;
+    if( !ok ) {
+        printf("Uniform: %s has type 0x%x, not 0x%x.\n",name,e->type,type);
+        return -1;
+    }
+    return e->location;
+}
+
+#define BINARY_CACHE_MAGIC      0x42505347     // "GSPB"
+#define BINARY_CACHE_VERSION    1
+
+struct BinaryCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int format;
+    unsigned int length;
+};
+
+void GLSLProgram::setBinaryCacheDir( const string & dir )
+{
+    binaryCacheDir = dir;
+}
+
+bool GLSLProgram::binaryCacheEnabled()
+{
+    if( binaryCacheDir.empty() ) return false;
+    if( !GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary ) return false;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// 64 bit FNV-1a
+static unsigned long long hashBytes( unsigned long long h, const void * data, size_t size )
+{
+    const unsigned char * p = (const unsigned char *)data;
+    for( size_t i = 0; i < size; ++i ) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static unsigned long long hashString( unsigned long long h, const char * s )
+{
+    // the terminator too, so "ab","c" and "a","bc" differ
+    return hashBytes(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+// Named by a hash of everything that goes into the binary: the stage
+// sources in order, attribute/output bindings, and the driver and the
+// binary formats it supports, so an update never gets served an old binary.
+string GLSLProgram::binaryCacheFile()
+{
+    unsigned long long h = 14695981039346656037ull;
+    h = hashString(h, (const char *)glGetString(GL_VENDOR));
+    h = hashString(h, (const char *)glGetString(GL_RENDERER));
+    h = hashString(h, (const char *)glGetString(GL_VERSION));
+
+    GLint nFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+    if( nFormats > 0 ) {
+        std::vector<GLint> formats(nFormats);
+        glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+        h = hashBytes(h, &formats[0], formats.size() * sizeof(GLint));
+    }
+
+    h = hashString(h, bindings.c_str());
+    for( size_t i = 0; i < pending.size(); ++i ) {
+        int type = pending[i].type;
+        h = hashBytes(h, &type, sizeof(type));
+        h = hashBytes(h, pending[i].source.data(), pending[i].source.size());
+        h = hashBytes(h, "", 1);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.glbin", h);
+    return binaryCacheDir + name;
+}
+
+bool GLSLProgram::loadBinary( const string & fileName )
+{
+    FILE * file = fopen(fileName.c_str(), "rb");
+    if( !file ) return false;
+
+    // a length that isn't the rest of the file is a damaged entry, checked
+    // before it's trusted with an allocation
+    long fileSize = -1;
+    if( !fseek(file, 0, SEEK_END) ) fileSize = ftell(file);
+    rewind(file);
+
+    BinaryCacheHeader header;
+    std::vector<char> binary;
+    bool ok = fileSize >= (long)sizeof(header) &&
+              fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == BINARY_CACHE_MAGIC &&
+              header.version == BINARY_CACHE_VERSION &&
+              header.length > 0 &&
+              (unsigned long)header.length == (unsigned long)fileSize - sizeof(header);
+    if( ok ) {
+        binary.resize(header.length);
+        ok = fread(&binary[0], header.length, 1, file) == 1;
+    }
+    fclose(file);
+    if( !ok ) return false;
+
+    // a rejected binary leaves the program unlinked, ready for the sources
+    glProgramBinary(handle, header.format, &binary[0], header.length);
+    GLint status = GL_FALSE;
+    glGetProgramiv(handle, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
+}
+
+// Written to a temporary and renamed so another process never reads half a
+// file.  The temporary is unique to this process and save, so two writers of
+// the same key each rename a whole file of their own.
+void GLSLProgram::saveBinary( const string & fileName )
+{
+    GLint length = 0;
+    glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+    if( length <= 0 ) return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(handle, length, &written, &format, &binary[0]);
+    if( written <= 0 ) return;
+
+    BinaryCacheHeader header = { BINARY_CACHE_MAGIC, BINARY_CACHE_VERSION, format, (unsigned int)written };
+    static std::atomic<unsigned int> saves(0);
+    ostringstream tmp;
+    tmp << fileName << '.' << getpid() << '.' << saves++ << ".tmp";
+    string tmpName = tmp.str();
+    FILE * file = fopen(tmpName.c_str(), "wb");
+    if( !file ) {
+        printf("Program binary cache: can't write %s\n", tmpName.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(&binary[0], written, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if( !ok || rename(tmpName.c_str(), fileName.c_str()) != 0 ) {
+        printf("Program binary cache: can't write %s\n", fileName.c_str());
+        remove(tmpName.c_str());
+    }
+}
+
+
+
+// Shader files are read once, then everything comes from here until
+// clearSourceCache().  Contents are shared_ptrs so a lookup only holds the
+// lock for the find.
+static std::mutex sourceMutex;
+static std::vector<string> includePaths;
+static std::unordered_map<string, std::shared_ptr<const string> > fileCache;
+static std::unordered_map<unsigned long long, std::shared_ptr<const string> > preprocessedCache;
+
+// One read into a buffer sized from the end offset
+static std::shared_ptr<const string> loadFile( const string & fileName )
+{
+    {
+        std::lock_guard<std::mutex> lock(sourceMutex);
+        std::unordered_map<string, std::shared_ptr<const string> >::iterator it = fileCache.find(fileName);
+        if( it != fileCache.end() )
+            return it->second;
+    }
+
+    ifstream inFile( fileName.c_str(), ios::in | ios::binary );
+    if( !inFile ) {
+        return std::shared_ptr<const string>();
+    }
+
+    inFile.seekg(0, ios::end);
+    std::streamoff size = inFile.tellg();
+    inFile.seekg(0, ios::beg);
+    if( size < 0 ) {
+        return std::shared_ptr<const string>();
+    }
+
+    std::shared_ptr<string> code = std::make_shared<string>(size_t(size), '\0');
+    if( size > 0 && !inFile.read(&(*code)[0], size) ) {
+        return std::shared_ptr<const string>();
+    }
+
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    return fileCache.insert(std::make_pair(fileName, std::shared_ptr<const string>(code))).first->second;
+}
+
+static string directoryOf( const string & fileName )
+{
+    size_t slash = fileName.find_last_of("/\\");
+    return slash == string::npos ? string() : fileName.substr(0, slash + 1);
+}
+
+// Folds "." and "dir/.." so one file always has one name
+static string normalizePath( const string & path )
+{
+    std::vector<string> parts;
+    size_t start = 0;
+    while( start <= path.size() ) {
+        size_t slash = path.find_first_of("/\\", start);
+        if( slash == string::npos ) slash = path.size();
+        string part = path.substr(start, slash - start);
+        if( part == ".." && !parts.empty() && parts.back() != ".." && !parts.back().empty() )
+            parts.pop_back();
+        else if( part != "." && (!part.empty() || parts.empty()) )
+            parts.push_back(part);
+        start = slash + 1;
+    }
+
+    string out;
+    for( size_t i = 0; i < parts.size(); ++i ) {
+        if( i ) out += '/';
+        out += parts[i];
+    }
+    return out;
+}
+
+// The name from an #include "name" or #include <name> line, if it is one
+static bool parseInclude( const char * line, const char * lineEnd, string & name )
+{
+    const char * p = line;
+    while( p < lineEnd && (*p == ' ' || *p == '\t') ) ++p;
+    if( p == lineEnd || *p != '#' ) return false;
+    ++p;
+    while( p < lineEnd && (*p == ' ' || *p == '\t') ) ++p;
+    if( lineEnd - p < 7 || strncmp(p, "include", 7) ) return false;
+    p += 7;
+    while( p < lineEnd && (*p == ' ' || *p == '\t') ) ++p;
+    if( p == lineEnd || (*p != '"' && *p != '<') ) return false;
+
+    char close = *p == '"' ? '"' : '>';
+    const char * start = ++p;
+    while( p < lineEnd && *p != close ) ++p;
+    if( p == lineEnd ) return false;
+    name.assign(start, p);
+    return true;
+}
+
+// The numbers from a #line N or #line N S line, if it is one.  source is
+// left alone without an S.
+static bool parseLine( const char * line, const char * lineEnd, int & number, int & source )
+{
+    const char * p = line;
+    while( p < lineEnd && (*p == ' ' || *p == '\t') ) ++p;
+    if( p == lineEnd || *p != '#' ) return false;
+    ++p;
+    while( p < lineEnd && (*p == ' ' || *p == '\t') ) ++p;
+    if( lineEnd - p < 5 || strncmp(p, "line", 4) || (p[4] != ' ' && p[4] != '\t') ) return false;
+
+    string args(p + 4, lineEnd);
+    int n, s;
+    int count = sscanf(args.c_str(), "%d %d", &n, &s);
+    if( count < 1 ) return false;
+    number = n;
+    if( count == 2 ) source = s;
+    return true;
+}
+
+// Includes are looked for next to the including file first, then in the
+// include paths.  A file that's already been included in this shader is
+// skipped, an implicit include guard that also stops cycles.  #line
+// directives keep compiler errors pointing at the right file (by its
+// position in included, 0 is the top level) and line.  #line directives
+// already in the text (like the one injectDefines() adds) are followed, so
+// the one after an include carries on from where they left off.
+static bool expandIncludes( const string & text, const string & dir, int sourceNumber,
+                            std::vector<string> & included, string & out, string & error )
+{
+    const char * p = text.c_str();
+    const char * end = p + text.size();
+    int lineNumber = 1;
+    while( p < end ) {
+        const char * lineEnd = (const char *)memchr(p, '\n', end - p);
+        if( !lineEnd ) lineEnd = end;
+
+        string name;
+        if( !parseInclude(p, lineEnd, name) ) {
+            out.append(p, lineEnd);
+            out += '\n';
+            // the line after a #line is the one it names
+            if( !parseLine(p, lineEnd, lineNumber, sourceNumber) )
+                ++lineNumber;
+            p = lineEnd + 1;
+            continue;
+        }
+
+        string path = normalizePath((!name.empty() && name[0] == '/') ? name : dir + name);
+        std::shared_ptr<const string> code = loadFile(path);
+        if( !code && !name.empty() && name[0] != '/' ) {
+            std::vector<string> paths;
+            {
+                std::lock_guard<std::mutex> lock(sourceMutex);
+                paths = includePaths;
+            }
+            for( size_t i = 0; i < paths.size() && !code; ++i ) {
+                path = normalizePath(paths[i] + '/' + name);
+                code = loadFile(path);
+            }
+        }
+        if( !code ) {
+            error = "Include not found: " + name;
+            return false;
+        }
+
+        bool seen = false;
+        for( size_t i = 0; i < included.size() && !seen; ++i )
+            seen = included[i] == path;
+        if( seen ) {
+            out += '\n';
+        } else {
+            included.push_back(path);
+            ostringstream line;
+            line << "#line 1 " << included.size() << '\n';
+            out += line.str();
+            if( !expandIncludes(*code, directoryOf(path), (int)included.size(), included, out, error) )
+                return false;
+            line.str("");
+            line << "#line " << lineNumber + 1 << ' ' << sourceNumber << '\n';
+            out += line.str();
+        }
+        p = lineEnd + 1;
+        ++lineNumber;
+    }
+    return true;
+}
+
+// Keyed on the content and the directory it's relative to, so the same
+// text through any program is only expanded once
+bool GLSLProgram::preprocessShader( const string & source, const string & dir, string & out, string * error )
+{
+    if( source.find("include") == string::npos ) {
+        out = source;
+        return true;
+    }
+
+    unsigned long long key = hashBytes(14695981039346656037ull, source.data(), source.size());
+    key = hashString(key, dir.c_str());
+    {
+        std::lock_guard<std::mutex> lock(sourceMutex);
+        std::unordered_map<unsigned long long, std::shared_ptr<const string> >::iterator it = preprocessedCache.find(key);
+        if( it != preprocessedCache.end() ) {
+            out = *it->second;
+            return true;
+        }
+    }
+
+    std::vector<string> included;
+    std::shared_ptr<string> expanded = std::make_shared<string>();
+    string message;
+    if( !expandIncludes(source, dir, 0, included, *expanded, message) ) {
+        if( error ) *error = message;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    preprocessedCache[key] = expanded;
+    out = *expanded;
+    return true;
+}
+
+bool GLSLProgram::readShaderFile( const char * fileName, string & source, string * error )
+{
+    std::shared_ptr<const string> code = loadFile(fileName);
+    if( !code ) {
+        if( error ) *error = "File not found.";
+        return false;
+    }
+    return preprocessShader(*code, directoryOf(fileName), source, error);
+}
+
+void GLSLProgram::addIncludePath( const string & dir )
+{
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    includePaths.push_back(dir);
+    preprocessedCache.clear();
+}
+
+void GLSLProgram::clearSourceCache()
+{
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    fileCache.clear();
+    preprocessedCache.clear();
 }
 
-bool GLSLProgram::fileExists( const string & fileName )
+
+
+string GLSLProgram::injectDefines( const string & source, const std::vector<string> & defines )
 {
-    struct stat info;
-    int ret = -1;
+    if( defines.empty() ) return source;
+
+    // the line after #version, or the start if there isn't one
+    size_t insert = 0;
+    int line = 1;
+    for( size_t p = 0, n = 1; p < source.size(); ++n ) {
+        size_t end = source.find('\n', p);
+        if( end == string::npos ) end = source.size();
+        size_t q = source.find_first_not_of(" \t", p);
+        if( q < end && !source.compare(q, 8, "#version") ) {
+            insert = end < source.size() ? end + 1 : end;
+            line = n + 1;
+            break;
+        }
+        p = end + 1;
+    }
 
-    ret = stat(fileName.c_str(), &info);
-    return 0 == ret;
+    ostringstream block;
+    if( insert == source.size() && insert && source[insert-1] != '\n' )
+        block << '\n';
+    for( size_t i = 0; i < defines.size(); ++i ) {
+        string d = defines[i];
+        size_t space = d.find_first_of(" =");
+        if( space != string::npos ) d[space] = ' ';
+        block << "#define " << d << '\n';
+    }
+    block << "#line " << line << '\n';
+
+    string out = source;
+    out.insert(insert, block.str());
+    return out;
 }
 
 
@@ -367,9 +1099,353 @@ int GLSLProgram::get_uniform_block_info(unsigned int block_index, GLenum info)
 
 void GLSLProgram::delete_program()
 {
+	// the name can be reused by the next glCreateProgram
+	if( currentProgram == handle )
+		currentProgram = -1;
+
 	glDeleteProgram(handle);
 	handle = 0;
 	linked = false;
+	uniforms.clear();
+	uniformMask = 0;
+	shadows.clear();
+	pending.clear();
+	bindings.clear();
+	binaryFile.clear();
+	fromBinaryCache = false;
+}
+
+
+
+GLSLCompileBatch::GLSLCompileBatch() : parallel(isParallel()) { }
+
+GLSLCompileBatch::~GLSLCompileBatch()
+{
+    finish();
+}
+
+bool GLSLCompileBatch::isParallel()
+{
+    return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+void GLSLCompileBatch::setCompilerThreads( GLuint count )
+{
+    if( GLEW_KHR_parallel_shader_compile )
+        glMaxShaderCompilerThreadsKHR(count);
+    else if( GLEW_ARB_parallel_shader_compile )
+        glMaxShaderCompilerThreadsARB(count);
+}
+
+// In parallel mode everything is handed to the driver right away, the
+// binary cache is checked here too so a hit costs nothing later.  In serial
+// mode the stages wait in prog until poll() gets to them.
+std::shared_future<bool> GLSLCompileBatch::submit( GLSLProgram & prog, const std::vector<GLSLShaderSource> & stages, Callback done )
+{
+    jobs.push_back(Job());
+    Job & job = jobs.back();
+    job.prog = &prog;
+    job.linking = false;
+    job.failed = !prog.createHandle();
+    job.done = done;
+    std::shared_future<bool> future = job.result.get_future().share();
+
+    for( size_t i = 0; i < stages.size() && !job.failed; ++i ) {
+        GLSLShaderSource stage = { stages[i].type, string() };
+        job.failed = !GLSLProgram::preprocessShader(stages[i].source, "", stage.source, &prog.logString);
+        prog.pending.push_back(stage);
+    }
+    // nothing of a failed submit may reach the program's next link()
+    if( job.failed ) prog.pending.clear();
+    if( job.failed || !parallel ) return future;
+
+    if( GLSLProgram::binaryCacheEnabled() && prog.loadCachedBinary() ) {
+        job.linking = true;
+        return future;
+    }
+    for( size_t i = 0; i < prog.pending.size() && !job.failed; ++i ) {
+        GLuint shader = prog.startCompile(prog.pending[i].source, prog.pending[i].type);
+        if( shader )
+            job.shaders.push_back(shader);
+        else
+            job.failed = true;
+    }
+    prog.pending.clear();
+    return future;
+}
+
+size_t GLSLCompileBatch::poll()
+{
+    return advance(false);
+}
+
+void GLSLCompileBatch::finish()
+{
+    advance(true);
+}
+
+size_t GLSLCompileBatch::pending() const
+{
+    return jobs.size();
+}
+
+// Jobs are looked at in submission order, a serial build takes one program
+// per poll() so the caller gets control back between them
+size_t GLSLCompileBatch::advance( bool wait )
+{
+    size_t completed = 0;
+    std::list<Job>::iterator it = jobs.begin();
+    while( it != jobs.end() ) {
+        bool ok;
+        if( !step(*it, wait, ok) ) {
+            ++it;
+            continue;
+        }
+
+        if( it->done )
+            it->done(*it->prog, ok);
+        it->result.set_value(ok);
+        it = jobs.erase(it);
+        ++completed;
+        if( !parallel && !wait )
+            break;
+    }
+    return completed;
+}
+
+// Moves a job along as far as it can go without blocking (unless wait is
+// set).  Returns true when it's finished, with the result in ok.
+bool GLSLCompileBatch::step( Job & job, bool wait, bool & ok )
+{
+    GLSLProgram & prog = *job.prog;
+    ok = false;
+    if( job.failed ) {
+        for( size_t i = 0; i < job.shaders.size(); ++i )
+            glDeleteShader(job.shaders[i]);
+        return true;
+    }
+
+    if( !parallel ) {
+        ok = prog.link();
+        return true;
+    }
+
+    if( !job.linking ) {
+        if( !wait ) {
+            for( size_t i = 0; i < job.shaders.size(); ++i ) {
+                GLint done = GL_FALSE;
+                glGetShaderiv(job.shaders[i], GL_COMPLETION_STATUS_KHR, &done);
+                if( !done ) return false;
+            }
+        }
+
+        bool compiled = true;
+        for( size_t i = 0; i < job.shaders.size(); ++i ) {
+            if( compiled )
+                compiled = prog.finishCompile(job.shaders[i]);
+            else
+                glDeleteShader(job.shaders[i]);
+        }
+        job.shaders.clear();
+        if( !compiled ) return true;
+
+        prog.startLink();
+        job.linking = true;
+        if( !wait ) return false;
+    }
+
+    if( !wait ) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(prog.handle, GL_COMPLETION_STATUS_KHR, &done);
+        if( !done ) return false;
+    }
+    ok = prog.finishLink();
+    return true;
+}
+
+
+
+struct GLSLVariant
+{
+    enum State { BUILDING, READY, FAILED };
+
+    GLSLProgram program;
+    State state;
+};
+
+struct VariantId
+{
+    unsigned long long sourceHash;
+    GLSLVariantKey key;
+
+    bool operator==( const VariantId & other ) const
+    {
+        return sourceHash == other.sourceHash && key == other.key;
+    }
+};
+
+struct VariantIdHash
+{
+    size_t operator()( const VariantId & id ) const
+    {
+        return std::hash<unsigned long long>()(id.sourceHash ^ (id.key * 0x9e3779b97f4a7c15ull));
+    }
+};
+
+// Owned here so variants outlive the sets that made them
+static std::unordered_map<VariantId, std::unique_ptr<GLSLVariant>, VariantIdHash> variantCache;
+
+GLSLVariants::GLSLVariants() : sourceHash(0) { }
+
+void GLSLVariants::setSources( const std::vector<GLSLShaderSource> & stages, const std::vector<string> & features )
+{
+    this->stages = stages;
+    this->features = features;
+    if( this->features.size() > 64 ) {
+        printf("GLSLVariants: only the first 64 of %d features can be used\n", (int)features.size());
+        this->features.resize(64);
+    }
+    rehash();
+}
+
+void GLSLVariants::bindAttribLocation( GLuint location, const char * name )
+{
+    attribs.push_back(std::make_pair(location, string(name)));
+    rehash();
+}
+
+void GLSLVariants::bindFragDataLocation( GLuint location, const char * name )
+{
+    fragData.push_back(std::make_pair(location, string(name)));
+    rehash();
+}
+
+void GLSLVariants::rehash()
+{
+    unsigned long long h = 14695981039346656037ull;
+    for( size_t i = 0; i < stages.size(); ++i ) {
+        int type = stages[i].type;
+        h = hashBytes(h, &type, sizeof(type));
+        h = hashString(h, stages[i].source.c_str());
+    }
+    for( size_t i = 0; i < features.size(); ++i )
+        h = hashString(h, features[i].c_str());
+    for( size_t i = 0; i < attribs.size(); ++i ) {
+        h = hashBytes(h, &attribs[i].first, sizeof(GLuint));
+        h = hashString(h, attribs[i].second.c_str());
+    }
+    h = hashString(h, "frag");
+    for( size_t i = 0; i < fragData.size(); ++i ) {
+        h = hashBytes(h, &fragData[i].first, sizeof(GLuint));
+        h = hashString(h, fragData[i].second.c_str());
+    }
+    sourceHash = h;
+}
+
+// bits past the last feature don't make a different variant
+GLSLVariantKey GLSLVariants::mask( GLSLVariantKey key )
+{
+    if( features.size() < 64 )
+        key &= (1ull << features.size()) - 1;
+    return key;
+}
+
+std::vector<string> GLSLVariants::definesFor( GLSLVariantKey key )
+{
+    std::vector<string> defines;
+    for( size_t i = 0; i < features.size(); ++i )
+        if( key & (1ull << i) )
+            defines.push_back(features[i]);
+    return defines;
+}
+
+std::vector<GLSLShaderSource> GLSLVariants::variantStages( GLSLVariantKey key )
+{
+    std::vector<string> defines = definesFor(key);
+    std::vector<GLSLShaderSource> out(stages);
+    for( size_t i = 0; i < out.size(); ++i )
+        out[i].source = GLSLProgram::injectDefines(out[i].source, defines);
+    return out;
+}
+
+void GLSLVariants::applyBindings( GLSLProgram & prog )
+{
+    for( size_t i = 0; i < attribs.size(); ++i )
+        prog.bindAttribLocation(attribs[i].first, attribs[i].second.c_str());
+    for( size_t i = 0; i < fragData.size(); ++i )
+        prog.bindFragDataLocation(fragData[i].first, fragData[i].second.c_str());
+}
+
+GLSLProgram * GLSLVariants::get( GLSLVariantKey key )
+{
+    VariantId id = { sourceHash, mask(key) };
+    std::unique_ptr<GLSLVariant> & v = variantCache[id];
+    if( v ) return v->state == GLSLVariant::READY ? &v->program : NULL;
+
+    v.reset(new GLSLVariant);
+    v->state = GLSLVariant::FAILED;
+    applyBindings(v->program);
+
+    std::vector<GLSLShaderSource> sources = variantStages(id.key);
+    bool ok = true;
+    for( size_t i = 0; i < sources.size() && ok; ++i )
+        ok = v->program.compileShaderFromString(sources[i].source, sources[i].type);
+    if( ok )
+        ok = v->program.link();
+    if( !ok ) {
+        printf("Variant 0x%llx failed to build!\n%s", id.key, v->program.log().c_str());
+        return NULL;
+    }
+
+    v->state = GLSLVariant::READY;
+    return &v->program;
+}
+
+GLSLProgram * GLSLVariants::request( GLSLVariantKey key, GLSLVariantKey fallback, GLSLCompileBatch & batch )
+{
+    VariantId id = { sourceHash, mask(key) };
+    std::unique_ptr<GLSLVariant> & v = variantCache[id];
+    if( !v ) {
+        v.reset(new GLSLVariant);
+        v->state = GLSLVariant::BUILDING;
+        applyBindings(v->program);
+
+        GLSLVariant * variant = v.get();
+        GLSLVariantKey built = id.key;
+        batch.submit(variant->program, variantStages(id.key), [variant, built]( GLSLProgram & prog, bool ok ) {
+            variant->state = ok ? GLSLVariant::READY : GLSLVariant::FAILED;
+            if( !ok )
+                printf("Variant 0x%llx failed to build!\n%s", built, prog.log().c_str());
+        });
+    }
+    if( v->state == GLSLVariant::READY )
+        return &v->program;
+
+    VariantId fallbackId = { sourceHash, mask(fallback) };
+    std::unordered_map<VariantId, std::unique_ptr<GLSLVariant>, VariantIdHash>::iterator it = variantCache.find(fallbackId);
+    if( it != variantCache.end() && it->second->state == GLSLVariant::READY )
+        return &it->second->program;
+    return NULL;
+}
+
+bool GLSLVariants::isReady( GLSLVariantKey key )
+{
+    VariantId id = { sourceHash, mask(key) };
+    std::unordered_map<VariantId, std::unique_ptr<GLSLVariant>, VariantIdHash>::iterator it = variantCache.find(id);
+    return it != variantCache.end() && it->second->state == GLSLVariant::READY;
+}
+
+void GLSLVariants::clearCache()
+{
+    std::unordered_map<VariantId, std::unique_ptr<GLSLVariant>, VariantIdHash>::iterator it;
+    for( it = variantCache.begin(); it != variantCache.end(); ++it )
+        it->second->program.delete_program();
+    variantCache.clear();
+}
+
+size_t GLSLVariants::cachedVariants()
+{
+    return variantCache.size();
 }
 
 
@@ -5,6 +5,10 @@
 #include <GL/gl.h>
 
 #include <string>
+#include <vector>
+#include <list>
+#include <functional>
+#include <future>
 #include <cstdarg>
 using std::string;
 
@@ -26,6 +30,51 @@ namespace GLSLShader {
     };
 }
 
+// GL type a UniformHandle<T> expects, checked when the handle is made
+template<class T> struct UniformType;
+template<> struct UniformType<float> { static const GLenum value = GL_FLOAT; };
+template<> struct UniformType<int>   { static const GLenum value = GL_INT; };
+template<> struct UniformType<bool>  { static const GLenum value = GL_BOOL; };
+template<> struct UniformType<vec2>  { static const GLenum value = GL_FLOAT_VEC2; };
+template<> struct UniformType<vec3>  { static const GLenum value = GL_FLOAT_VEC3; };
+template<> struct UniformType<vec4>  { static const GLenum value = GL_FLOAT_VEC4; };
+template<> struct UniformType<mat3>  { static const GLenum value = GL_FLOAT_MAT3; };
+template<> struct UniformType<mat4>  { static const GLenum value = GL_FLOAT_MAT4; };
+
+// A resolved uniform location, get one from GLSLProgram::getUniformHandle()
+// after link() and keep it to set the uniform with no name lookup at all.
+// Only valid for the program (and link) it came from.
+template<class T>
+class UniformHandle
+{
+public:
+    UniformHandle() : location(-1) { }
+    explicit UniformHandle( int loc ) : location(loc) { }
+
+    bool isValid() const { return location >= 0; }
+    int  getLocation() const { return location; }
+
+private:
+    int location;
+};
+
+// GL calls made and skipped because nothing would have changed, across
+// all programs
+struct GLSLStateStats
+{
+    unsigned long long useCalls;
+    unsigned long long usesSkipped;
+    unsigned long long uniformCalls;
+    unsigned long long uniformsSkipped;
+};
+
+// One stage of a program
+struct GLSLShaderSource
+{
+    GLSLShader::GLSLShaderType type;
+    string source;
+};
+
 class GLSLProgram
 {
 private:
@@ -33,13 +82,77 @@ private:
     bool linked;
     string logString;
 
+    // Active uniforms, filled in by link().  Open addressing on the FNV-1a
+    // hash of the name, so a lookup doesn't allocate or call into GL.
+    struct UniformEntry {
+        unsigned int hash;
+        int location;
+        GLenum type;
+        string name;        // empty for a free slot
+    };
+    std::vector<UniformEntry> uniforms;
+    unsigned int uniformMask;
+
+    // Last value set at each location, size 0 until the first set.  Only
+    // kept while this program is the tracked current one, since glUniform*
+    // goes to whatever program is bound.
+    struct UniformShadow {
+        unsigned int size;
+        unsigned char data[sizeof(mat4)];
+    };
+    std::vector<UniformShadow> shadows;
+
+    static int currentProgram;     // -1 when unknown
+    static GLSLStateStats stateStats;
+
+    bool uniformChanged( int location, const void * value, unsigned int size );
+
+    void cacheUniforms();
+    void addUniform( const string & name, int location, GLenum type );
+    const UniformEntry * findUniform( const char * name );
     int  getUniformLocation(const char * name );
-    bool fileExists( const string & fileName );
+    int  getUniformHandleLocation( const char * name, GLenum type );
+
+    // With the binary cache on, sources are only compiled at link() and
+    // only when there's no usable binary for them
+    std::vector<GLSLShaderSource> pending;
+    string bindings;        // attrib/frag data locations, part of the cache key
+    string binaryFile;      // where a source build gets saved
+    bool fromBinaryCache;
+
+    static string binaryCacheDir;
+
+    friend class GLSLCompileBatch;
+
+    bool   createHandle();
+    bool   addSource( const string & source, GLSLShader::GLSLShaderType type );
+    bool   compileShader( const string & source, GLSLShader::GLSLShaderType type );
+    GLuint startCompile( const string & source, GLSLShader::GLSLShaderType type );
+    bool   finishCompile( GLuint shaderHandle );
+    bool   loadCachedBinary();
+    void   startLink();
+    bool   finishLink();
+    string binaryCacheFile();
+    bool   loadBinary( const string & fileName );
+    void   saveBinary( const string & fileName );
 
 public:
     GLSLProgram();
 
     bool   compileShaderFromFile( const char * fileName, GLSLShader::GLSLShaderType type );
+
+    // Sources go through an #include "file" / #include <file> expander.
+    // Files are read once per process, and expanded text is cached by
+    // content, for all programs.  clearSourceCache() to see edits on disk.
+    static bool readShaderFile( const char * fileName, string & source, string * error = NULL );
+    static bool preprocessShader( const string & source, const string & dir, string & out, string * error = NULL );
+    static void addIncludePath( const string & dir );
+    static void clearSourceCache();
+
+    // "#define NAME" (or "#define NAME value" for "NAME value" or
+    // "NAME=value") lines right
+    // after #version, with a #line so errors keep their original numbers
+    static string injectDefines( const string & source, const std::vector<string> & defines );
     bool   compileShaderFromString( const string & source, GLSLShader::GLSLShaderType type );
     bool   link();
     bool   validate();
@@ -51,6 +164,20 @@ public:
     int    getHandle();
     bool   isLinked();
 
+    // Directory (which must exist) for linked program binaries, "" turns the
+    // cache off.  Affects programs that haven't been given sources yet.
+    static void setBinaryCacheDir( const string & dir );
+
+    // use() and setUniform() skip GL calls that wouldn't change anything.
+    // This assumes one context and that programs are only bound through
+    // use(), call invalidateCurrent() after binding one any other way.
+    static void invalidateCurrent();
+    static GLSLStateStats getStateStats();
+    static void resetStateStats();
+
+    static bool binaryCacheEnabled();
+    bool   isFromBinaryCache();
+
     void   bindAttribLocation( GLuint location, const char * name);
     void   bindFragDataLocation( GLuint location, const char * name );
 
@@ -62,6 +189,21 @@ public:
     void   setUniform( const char *name, float val );
     void   setUniform( const char *name, int val );
     void   setUniform( const char *name, bool val );
+
+    template<class T>
+    UniformHandle<T> getUniformHandle( const char *name )
+    {
+        return UniformHandle<T>(getUniformHandleLocation(name, UniformType<T>::value));
+    }
+
+    void   setUniform( UniformHandle<float> h, float val );
+    void   setUniform( UniformHandle<int> h, int val );
+    void   setUniform( UniformHandle<bool> h, bool val );
+    void   setUniform( UniformHandle<vec2> h, const vec2 & v );
+    void   setUniform( UniformHandle<vec3> h, const vec3 & v );
+    void   setUniform( UniformHandle<vec4> h, const vec4 & v );
+    void   setUniform( UniformHandle<mat3> h, const mat3 & m );
+    void   setUniform( UniformHandle<mat4> h, const mat4 & m );
 	
 	
 	int get_uniform_block_info(unsigned int block_index, GLenum info);
@@ -71,6 +213,113 @@ public:
 };
 
 
+// Builds many programs at once.  With GL_KHR_parallel_shader_compile (or
+// the ARB version) every compile and link is handed to the driver up front
+// and poll() finishes whichever are done without waiting on the rest, so
+// loading can carry on in between.  Without it each poll() builds the next
+// program in submission order.  The binary cache is used either way.
+//
+// Call it from the GL thread, the futures can be waited on from any other.
+// Programs have to outlive their jobs.
+class GLSLCompileBatch
+{
+public:
+    typedef std::function<void (GLSLProgram & prog, bool ok)> Callback;
+
+    GLSLCompileBatch();
+    ~GLSLCompileBatch();                    // finish()es
+
+    static bool isParallel();
+
+    // Driver compiler threads, 0xFFFFFFFF lets it choose.  Does nothing
+    // without the extension.
+    static void setCompilerThreads( GLuint count );
+
+    // stages go after anything already given to prog, done is called from
+    // poll()/finish() just before the future is ready
+    std::shared_future<bool> submit( GLSLProgram & prog, const std::vector<GLSLShaderSource> & stages,
+                                     Callback done = Callback() );
+
+    // returns how many programs completed
+    size_t poll();
+    void   finish();
+    size_t pending() const;
+
+private:
+    struct Job {
+        GLSLProgram * prog;
+        std::vector<GLuint> shaders;        // still compiling
+        bool linking;
+        bool failed;
+        Callback done;
+        std::promise<bool> result;
+    };
+    std::list<Job> jobs;
+    bool parallel;
+
+    size_t advance( bool wait );
+    bool   step( Job & job, bool wait, bool & ok );
+
+    GLSLCompileBatch( const GLSLCompileBatch & );
+    GLSLCompileBatch & operator=( const GLSLCompileBatch & );
+};
+
+
+// Bit i set means features[i] is defined
+typedef unsigned long long GLSLVariantKey;
+
+// One set of sources built with any combination of up to 64 feature
+// defines.  Variants are built the first time they're asked for, either
+// right there with get() or in a GLSLCompileBatch with request(), which
+// hands back a fallback variant until the requested one is ready.
+//
+// Built programs live in one table for the whole process, keyed by a hash
+// of the sources, features and bindings plus the key, so sets with the
+// same sources share them.  They go through the binary cache like any
+// other program.  GL thread only.
+class GLSLVariants
+{
+public:
+    GLSLVariants();
+
+    void setSources( const std::vector<GLSLShaderSource> & stages, const std::vector<string> & features );
+
+    // applied to every variant before it's linked
+    void bindAttribLocation( GLuint location, const char * name );
+    void bindFragDataLocation( GLuint location, const char * name );
+
+    // Builds the variant if it hasn't been, NULL if it doesn't build or is
+    // still building in a batch
+    GLSLProgram * get( GLSLVariantKey key );
+
+    // Never compiles here: returns the variant if it's ready, otherwise
+    // starts it in batch (if it isn't already) and returns the fallback
+    // variant if that one's ready, else NULL.  batch has to be polled.
+    GLSLProgram * request( GLSLVariantKey key, GLSLVariantKey fallback, GLSLCompileBatch & batch );
+
+    bool   isReady( GLSLVariantKey key );
+    std::vector<string> definesFor( GLSLVariantKey key );
+
+    // Deletes every built variant of every set, don't call with variants
+    // still in a batch
+    static void clearCache();
+    static size_t cachedVariants();
+
+private:
+    std::vector<GLSLShaderSource> stages;
+    std::vector<string> features;
+    std::vector<std::pair<GLuint, string> > attribs, fragData;
+    unsigned long long sourceHash;
+
+    void   rehash();
+    GLSLVariantKey mask( GLSLVariantKey key );
+    std::vector<GLSLShaderSource> variantStages( GLSLVariantKey key );
+    void   applyBindings( GLSLProgram & prog );
+};
+
+
+// Compiles and links from (type, file) pairs, exits on failure.  See
+// GLSLCompileBatch to build programs without blocking.
 void compileAndLinkShader(GLSLProgram& prog, int num_shaders, ...);
 
 #endif // GLSLPROGRAM_H
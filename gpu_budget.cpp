@@ -0,0 +1,186 @@
+/*
+ *GPU memory accounting with least recently used eviction
+ *BSD license (see LICENSE)
+ */
+
+#include "gpu_budget.h"
+
+#include <string.h>
+
+
+GpuResource::GpuResource()
+{
+	evicted = false;
+	budget = NULL;
+	gpu_bytes = 0;
+	prev = next = NULL;
+}
+
+GpuResource::~GpuResource()
+{
+	if (budget)
+		budget->remove(this);
+}
+
+
+void GpuResource::set_gpu_size(size_t bytes)
+{
+	if (budget)
+		budget->resize(this, bytes);
+	else
+		gpu_bytes = bytes;
+	if (bytes)
+		evicted = false;
+}
+
+
+void GpuResource::touch()
+{
+	if (budget)
+		budget->touch(this);
+}
+
+
+
+GpuBudget::GpuBudget(size_t budget)
+{
+	mru = lru = NULL;
+	memset(&st, 0, sizeof(st));
+	st.budget = budget;
+}
+
+//resources outliving the budget just stop being tracked
+GpuBudget::~GpuBudget()
+{
+	while (mru) {
+		GpuResource* r = mru;
+		unlink(r);
+		r->budget = NULL;
+	}
+}
+
+
+void GpuBudget::set_budget(size_t bytes)
+{
+	st.budget = bytes;
+	trim();
+}
+
+
+void GpuBudget::add(GpuResource* r)
+{
+	if (r->budget == this)
+		return;
+	if (r->budget)
+		r->budget->remove(r);
+
+	r->budget = this;
+	push_front(r);
+	st.resources++;
+	if (r->evicted)
+		st.evicted++;
+	st.used += r->gpu_bytes;
+	if (st.used > st.peak)
+		st.peak = st.used;
+	trim(r);
+}
+
+
+void GpuBudget::remove(GpuResource* r)
+{
+	if (r->budget != this)
+		return;
+
+	unlink(r);
+	r->budget = NULL;
+	st.resources--;
+	if (r->evicted)
+		st.evicted--;
+	st.used -= r->gpu_bytes;
+}
+
+
+bool GpuBudget::evict(GpuResource* r)
+{
+	if (r->budget != this || r->evicted || !r->gpu_bytes || !r->evict())
+		return false;
+
+	r->evicted = true;
+	st.used -= r->gpu_bytes;
+	st.evicted++;
+	st.evictions++;
+	st.evicted_bytes += r->gpu_bytes;
+	r->gpu_bytes = 0;
+	return true;
+}
+
+
+void GpuBudget::trim(GpuResource* keep)
+{
+	if (!st.budget)
+		return;
+
+	GpuResource* r = lru;
+	while (r && st.used > st.budget) {
+		GpuResource* warmer = r->prev;
+		if (r != keep)
+			evict(r);
+		r = warmer;
+	}
+}
+
+
+//an upload (or an eviction the resource did itself) changed its size
+void GpuBudget::resize(GpuResource* r, size_t bytes)
+{
+	if (r->evicted && bytes) {
+		st.evicted--;
+		st.restores++;
+		st.restored_bytes += bytes;
+	}
+
+	st.used += bytes;
+	st.used -= r->gpu_bytes;
+	r->gpu_bytes = bytes;
+	if (st.used > st.peak)
+		st.peak = st.used;
+
+	touch(r);
+	trim(r);
+}
+
+
+void GpuBudget::touch(GpuResource* r)
+{
+	if (mru == r)
+		return;
+	unlink(r);
+	push_front(r);
+}
+
+
+void GpuBudget::unlink(GpuResource* r)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		mru = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+	else
+		lru = r->prev;
+	r->prev = r->next = NULL;
+}
+
+
+void GpuBudget::push_front(GpuResource* r)
+{
+	r->prev = NULL;
+	r->next = mru;
+	if (mru)
+		mru->prev = r;
+	else
+		lru = r;
+	mru = r;
+}
+
@@ -0,0 +1,107 @@
+/*
+ *GPU memory accounting with least recently used eviction
+ *BSD license (see LICENSE)
+ */
+
+#ifndef GPU_BUDGET_H
+#define GPU_BUDGET_H
+
+#include <stddef.h>
+
+
+class GpuBudget;
+
+
+//Anything holding GPU memory that can give it up and get it back later.
+//Derived classes report their size with set_gpu_size() after every upload
+//and call touch() whenever they're used.
+class GpuResource
+{
+public:
+	GpuResource();
+	virtual ~GpuResource();
+
+	size_t gpu_size() const { return gpu_bytes; }
+	bool is_evicted() const { return evicted; }
+	GpuBudget* get_budget() const { return budget; }
+
+protected:
+	bool evicted;
+
+	//Free the GPU memory, keeping what's needed to upload again.  Returns
+	//false if it can't right now.  Called through GpuBudget::evict().
+	virtual bool evict() = 0;
+
+	void set_gpu_size(size_t bytes);
+	void touch();
+
+private:
+	friend class GpuBudget;
+
+	GpuBudget* budget;
+	size_t gpu_bytes;
+	GpuResource* prev;		//towards the most recently used
+	GpuResource* next;
+
+	GpuResource(const GpuResource&);
+	GpuResource& operator=(const GpuResource&);
+};
+
+
+struct GpuBudgetStats
+{
+	size_t budget;			//0 is unlimited
+	size_t used;
+	size_t peak;
+	size_t resources;		//added and not removed
+	size_t evicted;			//of those, currently evicted
+	size_t evictions;		//totals since creation
+	size_t restores;
+	size_t evicted_bytes;
+	size_t restored_bytes;
+};
+
+
+//Keeps the resources added to it in least recently used order and evicts
+//from the cold end whenever an upload takes the total over budget.  The
+//resource being uploaded is never evicted for itself, so a single one
+//bigger than the budget still works.  Render thread only, like the GL
+//calls behind it.
+class GpuBudget
+{
+public:
+	GpuBudget(size_t budget = 0);
+	~GpuBudget();
+
+	//evicts down to the new budget right away
+	void set_budget(size_t bytes);
+
+	void add(GpuResource* r);
+	void remove(GpuResource* r);
+
+	bool evict(GpuResource* r);
+
+	//evict until used <= budget, never keep
+	void trim(GpuResource* keep = NULL);
+
+	GpuBudgetStats stats() const { return st; }
+
+private:
+	friend class GpuResource;
+
+	GpuResource* mru;
+	GpuResource* lru;
+	GpuBudgetStats st;
+
+	void resize(GpuResource* r, size_t bytes);
+	void touch(GpuResource* r);
+	void unlink(GpuResource* r);
+	void push_front(GpuResource* r);
+
+	GpuBudget(const GpuBudget&);
+	GpuBudget& operator=(const GpuBudget&);
+};
+
+
+#endif
+
@@ -0,0 +1,50 @@
+/*
+ *Read only memory mapped files
+ *BSD license (see LICENSE)
+ */
+
+#include "mapped_file.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) || !info.st_size) {
+		::close(fd);
+		return false;
+	}
+
+	void* p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	//the mapping keeps the file open
+	if (p == MAP_FAILED)
+		return false;
+
+	//it's all going to be read front to back by the driver
+	madvise(p, info.st_size, MADV_SEQUENTIAL);
+	madvise(p, info.st_size, MADV_WILLNEED);
+
+	data = (const unsigned char*)p;
+	size = info.st_size;
+	return true;
+}
+
+
+void MappedFile::close()
+{
+	if (data)
+		munmap((void*)data, size);
+	data = NULL;
+	size = 0;
+}
+
@@ -0,0 +1,32 @@
+/*
+ *Read only memory mapped files
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+
+//read only mapping of a whole file
+class MappedFile
+{
+public:
+	const unsigned char* data;
+	size_t size;
+
+	MappedFile() : data(NULL), size(0) { }
+	~MappedFile() { close(); }
+
+	bool open(const char* path);
+	void close();
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+
+#endif
+
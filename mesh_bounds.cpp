@@ -0,0 +1,196 @@
+/*
+ *Bounding boxes and spheres of vertex arrays
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_bounds.h"
+#include "parallel.h"
+
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+//vertices per thread worth the overhead
+#define BOUNDS_MIN_ITEMS	(1 << 15)
+
+
+static inline glm::vec3 load_position(const unsigned char* data, size_t stride, size_t pos_offset, size_t i)
+{
+	glm::vec3 p;
+	memcpy(&p, data + i*stride + pos_offset, sizeof(p));
+	return p;
+}
+
+
+static void box_range(const unsigned char* data, size_t count, size_t stride, size_t pos_offset,
+                      size_t begin, size_t end, glm::vec3& min, glm::vec3& max)
+{
+	min = max = load_position(data, stride, pos_offset, begin);
+	size_t i = begin + 1;
+#ifdef __SSE2__
+	//A 16 byte load picks up one float past the position, harmless except
+	//past the end of the array for the very last vertex.
+	size_t simd_end = (end == count && pos_offset + 16 > stride) ? end - 1 : end;
+	if (i < simd_end) {
+		const unsigned char* p = data + pos_offset;
+		__m128 vmin = _mm_loadu_ps((const float*)(p + begin*stride));
+		__m128 vmax = vmin;
+		for (; i<simd_end; ++i) {
+			__m128 v = _mm_loadu_ps((const float*)(p + i*stride));
+			vmin = _mm_min_ps(vmin, v);
+			vmax = _mm_max_ps(vmax, v);
+		}
+		float lo[4], hi[4];
+		_mm_storeu_ps(lo, vmin);
+		_mm_storeu_ps(hi, vmax);
+		min = glm::vec3(lo[0], lo[1], lo[2]);
+		max = glm::vec3(hi[0], hi[1], hi[2]);
+	}
+#endif
+	for (; i<end; ++i) {
+		glm::vec3 p = load_position(data, stride, pos_offset, i);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+}
+
+
+void compute_box(const void* verts, size_t count, size_t stride, size_t pos_offset,
+                 glm::vec3& min, glm::vec3& max, unsigned int threads)
+{
+	if (!count) {
+		min = max = glm::vec3(0.0f);
+		return;
+	}
+
+	const unsigned char* data = (const unsigned char*)verts;
+	std::vector<glm::vec3> mins(worker_count(threads)), maxs(mins.size());
+	unsigned int used = parallel_for(count, threads, BOUNDS_MIN_ITEMS, [&](unsigned int t, size_t begin, size_t end) {
+		box_range(data, count, stride, pos_offset, begin, end, mins[t], maxs[t]);
+	});
+
+	min = mins[0];
+	max = maxs[0];
+	for (unsigned int t=1; t<used; ++t) {
+		min = glm::min(min, mins[t]);
+		max = glm::max(max, maxs[t]);
+	}
+}
+
+
+//index of the point farthest from p
+static size_t farthest(const unsigned char* data, size_t count, size_t stride, size_t pos_offset,
+                       const glm::vec3& p, unsigned int threads)
+{
+	std::vector<size_t> best(worker_count(threads));
+	std::vector<float> best_d2(best.size());
+	unsigned int used = parallel_for(count, threads, BOUNDS_MIN_ITEMS, [&](unsigned int t, size_t begin, size_t end) {
+		size_t b = begin;
+		float bd = -1.0f;
+		for (size_t i=begin; i<end; ++i) {
+			glm::vec3 d = load_position(data, stride, pos_offset, i) - p;
+			float d2 = glm::dot(d, d);
+			if (d2 > bd) {
+				bd = d2;
+				b = i;
+			}
+		}
+		best[t] = b;
+		best_d2[t] = bd;
+	});
+
+	size_t b = best[0];
+	for (unsigned int t=1; t<used; ++t)
+		if (best_d2[t] > best_d2[0]) {
+			best_d2[0] = best_d2[t];
+			b = best[t];
+		}
+	return b;
+}
+
+//smallest sphere holding both
+static void sphere_union(glm::vec3& c, float& r, const glm::vec3& c2, float r2)
+{
+	glm::vec3 d = c2 - c;
+	float dist = sqrtf(glm::dot(d, d));
+	if (dist + r2 <= r)
+		return;
+	if (dist + r <= r2) {
+		c = c2;
+		r = r2;
+		return;
+	}
+	float nr = (dist + r + r2) * 0.5f;
+	c += d * ((nr - r) / dist);
+	r = nr;
+}
+
+
+void compute_bounds(Bounds& out, const void* verts, size_t count, size_t stride, size_t pos_offset,
+                    unsigned int threads)
+{
+	compute_box(verts, count, stride, pos_offset, out.min, out.max, threads);
+	out.center = (out.min + out.max) * 0.5f;
+	out.radius = 0.0f;
+	if (!count)
+		return;
+
+	const unsigned char* data = (const unsigned char*)verts;
+
+	glm::vec3 y = load_position(data, stride, pos_offset, farthest(data, count, stride, pos_offset, load_position(data, stride, pos_offset, 0), threads));
+	glm::vec3 z = load_position(data, stride, pos_offset, farthest(data, count, stride, pos_offset, y, threads));
+	glm::vec3 seed_c = (y + z) * 0.5f;
+	float seed_r = glm::length(z - y) * 0.5f;
+
+	//each thread grows its own copy of the seed sphere, and the radius
+	//around the box center comes for free in the same pass
+	size_t n = worker_count(threads);
+	std::vector<glm::vec3> centers(n, seed_c);
+	std::vector<float> radii(n, seed_r), box_r2(n, 0.0f);
+	unsigned int used = parallel_for(count, threads, BOUNDS_MIN_ITEMS, [&](unsigned int t, size_t begin, size_t end) {
+		glm::vec3 c = centers[t];
+		float r = radii[t], r2 = r*r, br2 = 0.0f;
+		for (size_t i=begin; i<end; ++i) {
+			glm::vec3 p = load_position(data, stride, pos_offset, i);
+			glm::vec3 d = p - c;
+			float d2 = glm::dot(d, d);
+			if (d2 > r2) {
+				float dist = sqrtf(d2);
+				float nr = (r + dist) * 0.5f;
+				c += d * ((nr - r) / dist);
+				r = nr;
+				r2 = r*r;
+			}
+			glm::vec3 b = p - out.center;
+			float b2 = glm::dot(b, b);
+			if (b2 > br2)
+				br2 = b2;
+		}
+		centers[t] = c;
+		radii[t] = r;
+		box_r2[t] = br2;
+	});
+
+	glm::vec3 c = centers[0];
+	float r = radii[0], br2 = box_r2[0];
+	for (unsigned int t=1; t<used; ++t) {
+		sphere_union(c, r, centers[t], radii[t]);
+		if (box_r2[t] > br2)
+			br2 = box_r2[t];
+	}
+
+	//a little slack for the rounding in the incremental updates
+	float box_r = sqrtf(br2);
+	if (r < box_r) {
+		out.center = c;
+		out.radius = r * (1.0f + 1e-5f);
+	} else {
+		out.radius = box_r * (1.0f + 1e-6f);
+	}
+}
+
@@ -0,0 +1,36 @@
+/*
+ *Bounding boxes and spheres of vertex arrays
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_BOUNDS_H
+#define MESH_BOUNDS_H
+
+#include <stddef.h>
+#include <glm/glm.hpp>
+
+
+struct Bounds
+{
+	glm::vec3 min, max;	//axis aligned box
+	glm::vec3 center;	//sphere
+	float radius;
+};
+
+
+//Box of the glm::vec3 positions at pos_offset in an interleaved array.
+//SSE min/max per thread, then the partial boxes are merged.  Empty arrays
+//give a zero box at the origin.
+void compute_box(const void* verts, size_t count, size_t stride, size_t pos_offset,
+                 glm::vec3& min, glm::vec3& max, unsigned int threads = 0);
+
+//Box plus a Ritter sphere: start from the two points found by walking to
+//the farthest point twice, then grow to take in everything.  Large arrays
+//grow one sphere per thread and merge them.  The sphere around the box
+//center is used instead when it happens to be smaller.
+void compute_bounds(Bounds& out, const void* verts, size_t count, size_t stride, size_t pos_offset,
+                    unsigned int threads = 0);
+
+
+#endif
+
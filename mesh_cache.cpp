@@ -0,0 +1,94 @@
+/*
+ *Binary mesh files, loaded with mmap and uploaded without a copy
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+const MeshCacheHeader* validate_mesh_cache(const MappedFile& file, uint32_t signature, uint32_t stride)
+{
+	if (file.size < sizeof(MeshCacheHeader)) {
+		fprintf(stderr, "mesh cache: file too small\n");
+		return NULL;
+	}
+
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file.data;
+	if (h->magic != MESH_CACHE_MAGIC || h->version != MESH_CACHE_VERSION) {
+		fprintf(stderr, "mesh cache: bad magic or version %u\n", h->version);
+		return NULL;
+	}
+	if (h->layout_signature != signature || h->stride != stride) {
+		fprintf(stderr, "mesh cache: vertex layout doesn't match\n");
+		return NULL;
+	}
+
+	if (h->index_type != GL_UNSIGNED_SHORT && h->index_type != GL_UNSIGNED_INT &&
+	    (h->index_type || h->index_count)) {
+		fprintf(stderr, "mesh cache: bad index type 0x%x\n", h->index_type);
+		return NULL;
+	}
+	if (h->primitive > GL_PATCHES || (h->primitive > GL_TRIANGLE_FAN && h->primitive < GL_LINES_ADJACENCY)) {
+		fprintf(stderr, "mesh cache: bad primitive 0x%x\n", h->primitive);
+		return NULL;
+	}
+
+	//divided, a crafted count can't wrap the products around to a small size
+	uint64_t isize = (h->index_type == GL_UNSIGNED_SHORT) ? 2 : 4;
+	if (h->vertex_offset > file.size || h->vertex_count > (file.size - h->vertex_offset) / h->stride ||
+	    (h->index_count && (h->index_offset > file.size || h->index_count > (file.size - h->index_offset) / isize))) {
+		fprintf(stderr, "mesh cache: truncated file\n");
+		return NULL;
+	}
+
+	return h;
+}
+
+
+static inline uint64_t align_up(uint64_t x)
+{
+	return (x + MESH_CACHE_ALIGN-1) & ~uint64_t(MESH_CACHE_ALIGN-1);
+}
+
+static bool write_padded(FILE* f, const void* data, size_t bytes, uint64_t& pos, uint64_t target)
+{
+	static const unsigned char zeros[MESH_CACHE_ALIGN] = { 0 };
+	if (pos < target && fwrite(zeros, 1, target - pos, f) != target - pos)
+		return false;
+	pos = target;
+
+	if (bytes && fwrite(data, 1, bytes, f) != bytes)
+		return false;
+	pos += bytes;
+	return true;
+}
+
+
+bool write_mesh_cache_file(const char* path, MeshCacheHeader& h,
+                           const void* vdata, size_t vbytes, const void* idata, size_t ibytes)
+{
+	h.magic = MESH_CACHE_MAGIC;
+	h.version = MESH_CACHE_VERSION;
+	h.vertex_offset = align_up(sizeof(MeshCacheHeader));
+	h.index_offset = align_up(h.vertex_offset + vbytes);
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+
+	uint64_t pos = 0;
+	bool ok = write_padded(f, &h, sizeof(h), pos, 0) &&
+	          write_padded(f, vdata, vbytes, pos, h.vertex_offset) &&
+	          write_padded(f, idata, ibytes, pos, h.index_offset);
+
+	if (fclose(f))
+		ok = false;
+
+	if (!ok)
+		remove(path);
+	return ok;
+}
+
@@ -0,0 +1,170 @@
+/*
+ *Binary mesh files, loaded with mmap and uploaded without a copy
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Mesh.h"
+#include "mapped_file.h"
+
+
+#define MESH_CACHE_MAGIC	0x4853454D	//"MESH" little endian
+#define MESH_CACHE_VERSION	2
+#define MESH_CACHE_ALIGN	64		//vertex and index data start on this
+
+
+//File layout: header, vertex data at vertex_offset (GPU format, see
+//gpu_vertex), index data at index_offset.  Little endian, no byte swapping
+//is done on load.
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t layout_signature;	//gpu_vertex<Vertex>::signature
+	uint32_t stride;
+	uint32_t primitive;
+	uint32_t index_type;		//0 if not indexed
+	uint64_t vertex_count;
+	uint64_t index_count;
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	float quant_min[3];		//QuantBox for VF_UNORM16_BOX layouts
+	float quant_extent[3];
+	float bounds_min[3];		//Mesh::bounds
+	float bounds_max[3];
+	float bounds_center[3];
+	float bounds_radius;
+};
+
+
+//Checks magic, version, signature, the index type and primitive and that
+//the offsets are inside the file.
+//Returns the header or NULL (and prints why) if it's not usable.
+const MeshCacheHeader* validate_mesh_cache(const MappedFile& file, uint32_t signature, uint32_t stride);
+
+bool write_mesh_cache_file(const char* path, MeshCacheHeader& header,
+                           const void* vdata, size_t vbytes, const void* idata, size_t ibytes);
+
+
+//Writes a mesh after end() (so it's welded/optimized and the quantization
+//box is current).  Data is written in exactly the format that's uploaded.
+template<class Vertex, class Alloc>
+bool write_mesh_cache(const char* path, const Mesh<Vertex, Alloc>& mesh)
+{
+	typedef gpu_vertex<Vertex> gpu;
+
+	MeshCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	h.layout_signature = gpu::signature;
+	h.stride = gpu::stride;
+	//restart joined strips are stored as GL_TRIANGLE_STRIP
+	const std::vector<GLuint>& indices = mesh.stripped ? mesh.strip_indices : mesh.indices;
+	h.primitive = mesh.stripped ? GL_TRIANGLE_STRIP : mesh.primitive;
+	h.vertex_count = mesh.verts.size();
+	h.index_count = mesh.indexed ? indices.size() : 0;
+	h.index_type = mesh.indexed ? mesh.index_type : 0;
+
+	for (int i=0; i<3; ++i) {
+		h.quant_min[i] = mesh.quant.min[i];
+		h.quant_extent[i] = mesh.quant.extent[i];
+	}
+
+	for (int i=0; i<3; ++i) {
+		h.bounds_min[i] = mesh.bounds.min[i];
+		h.bounds_max[i] = mesh.bounds.max[i];
+		h.bounds_center[i] = mesh.bounds.center[i];
+	}
+	h.bounds_radius = mesh.bounds.radius;
+
+	std::vector<unsigned char> packed;
+	const void* vdata = mesh.verts.empty() ? NULL : &mesh.verts[0];
+	if (gpu::layout::packed && !mesh.verts.empty()) {
+		packed.resize(gpu::stride * mesh.verts.size());
+		gpu::pack(&mesh.verts[0], mesh.verts.size(), &packed[0], mesh.quant);
+		vdata = &packed[0];
+	}
+
+	std::vector<GLushort> short_indices;
+	const void* idata = NULL;
+	size_t ibytes = 0;
+	if (h.index_count) {
+		if (h.index_type == GL_UNSIGNED_SHORT) {
+			short_indices.assign(indices.begin(), indices.end());
+			idata = &short_indices[0];
+			ibytes = sizeof(GLushort) * short_indices.size();
+		} else {
+			idata = &indices[0];
+			ibytes = sizeof(GLuint) * indices.size();
+		}
+	}
+
+	return write_mesh_cache_file(path, h, vdata, gpu::stride * mesh.verts.size(), idata, ibytes);
+}
+
+
+//load_mesh_cache() without setting mesh.reload
+template<class Vertex, class Alloc>
+bool upload_mesh_cache(const char* path, Mesh<Vertex, Alloc>& mesh, MeshCacheHeader* header = NULL)
+{
+	typedef gpu_vertex<Vertex> gpu;
+
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	const MeshCacheHeader* h = validate_mesh_cache(file, gpu::signature, gpu::stride);
+	if (!h)
+		return false;
+
+	//drawing any indexed strip with restart on is harmless
+	mesh.stripped = h->primitive == GL_TRIANGLE_STRIP && h->index_count;
+	if (mesh.stripped && !GLEW_VERSION_4_3 && !GLEW_ARB_ES3_compatibility) {
+		fprintf(stderr, "mesh cache: %s is stripped, no primitive restart to draw it with\n", path);
+		return false;
+	}
+	mesh.primitive = mesh.stripped ? GL_TRIANGLES : h->primitive;
+	set_quant_box(mesh.quant, glm::vec3(h->quant_min[0], h->quant_min[1], h->quant_min[2]),
+	              glm::vec3(h->quant_min[0] + h->quant_extent[0], h->quant_min[1] + h->quant_extent[1], h->quant_min[2] + h->quant_extent[2]));
+
+	for (int i=0; i<3; ++i) {
+		mesh.bounds.min[i] = h->bounds_min[i];
+		mesh.bounds.max[i] = h->bounds_max[i];
+		mesh.bounds.center[i] = h->bounds_center[i];
+	}
+	mesh.bounds.radius = h->bounds_radius;
+
+	const void* idata = h->index_count ? file.data + h->index_offset : NULL;
+	mesh.end(file.data + h->vertex_offset, h->vertex_count, idata, h->index_count, h->index_type);
+
+	if (header)
+		*header = *h;
+	return true;
+}
+
+
+//Maps path and uploads it with Mesh::end(gpu_verts, ...).  The mapping is
+//dropped once GL has the data, mesh.verts/indices stay empty but
+//mesh.bounds is restored.  header, if given, receives a copy of the file
+//header.  If a GpuBudget evicts the mesh it's read from path again.
+template<class Vertex, class Alloc>
+bool load_mesh_cache(const char* path, Mesh<Vertex, Alloc>& mesh, MeshCacheHeader* header = NULL)
+{
+	if (!upload_mesh_cache(path, mesh, header))
+		return false;
+
+	std::string p(path);
+	mesh.reload = [p](Mesh<Vertex, Alloc>& m) { return upload_mesh_cache(p.c_str(), m); };
+	return true;
+}
+
+
+#endif
+
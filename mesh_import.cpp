@@ -0,0 +1,910 @@
+/*
+ *Multithreaded OBJ and PLY loading straight into a Mesh
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_import.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+
+//below this a file (or piece of a file) isn't worth another thread
+#define IMPORT_MIN_CHUNK	(1 << 16)
+
+//a vertex as the importers see it, written out through a VertexSink
+enum { SLOT_POS = 0, SLOT_NORMAL = 3, SLOT_TEX = 6, SLOT_COLOR = 8, SLOT_COUNT = 12 };
+
+static const float default_slots[SLOT_COUNT] = { 0,0,0, 0,0,0, 0,0, 1,1,1,1 };
+
+
+static inline void store_vertex(const VertexSink& s, size_t i, const float* slots)
+{
+	unsigned char* v = s.base + i*s.stride;
+	memcpy(v + s.pos, &slots[SLOT_POS], 3*sizeof(float));
+	if (s.normal != VertexSink::NOT_PRESENT)
+		memcpy(v + s.normal, &slots[SLOT_NORMAL], (s.normal_components < 3 ? s.normal_components : 3)*sizeof(float));
+	if (s.tex != VertexSink::NOT_PRESENT)
+		memcpy(v + s.tex, &slots[SLOT_TEX], (s.tex_components < 2 ? s.tex_components : 2)*sizeof(float));
+	if (s.color != VertexSink::NOT_PRESENT)
+		memcpy(v + s.color, &slots[SLOT_COLOR], (s.color_components < 4 ? s.color_components : 4)*sizeof(float));
+}
+
+
+static inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && is_blank(*p))
+		++p;
+	return p;
+}
+
+//first byte of the line containing pos, or pos itself if a line starts
+//there.  Every thread computes its range ends with this so they meet exactly.
+static size_t line_boundary(const char* data, size_t size, size_t pos)
+{
+	if (pos == 0 || pos >= size)
+		return pos < size ? pos : size;
+	const char* nl = (const char*)memchr(data + pos - 1, '\n', size - pos + 1);
+	return nl ? nl - data + 1 : size;
+}
+
+
+static const double pow10_table[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//Locale independent and much faster than strtof, which dominates a single
+//threaded loader.  Keeps 19 significant digits and scales in double so it's
+//within an ulp of the correctly rounded float.  Returns NULL if there's no
+//number at p.
+static const char* parse_float(const char* p, const char* end, float* out)
+{
+	p = skip_blanks(p, end);
+
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	unsigned long long mant = 0;
+	int exp = 0, digits = 0;
+	bool any = false;
+	for (; p < end && (unsigned)(*p - '0') < 10; ++p, any = true) {
+		if (digits < 19) {
+			mant = mant*10 + (*p - '0');
+			digits += mant != 0;
+		} else {
+			++exp;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && (unsigned)(*p - '0') < 10; ++p, any = true) {
+			if (digits < 19) {
+				mant = mant*10 + (*p - '0');
+				digits += mant != 0;
+				--exp;
+			}
+		}
+	}
+	if (!any)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		bool eneg = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+		if (q < end && (unsigned)(*q - '0') < 10) {
+			int e = 0;
+			for (; q < end && (unsigned)(*q - '0') < 10; ++q)
+				if (e < 10000)
+					e = e*10 + (*q - '0');
+			exp += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	double v = (double)mant;
+	if (exp < 0)
+		v = exp >= -22 ? v / pow10_table[-exp] : v * pow(10.0, exp);
+	else if (exp > 0)
+		v = exp <= 22 ? v * pow10_table[exp] : v * pow(10.0, exp);
+
+	*out = (float)(neg ? -v : v);
+	return p;
+}
+
+static const char* parse_int(const char* p, const char* end, long long* out)
+{
+	p = skip_blanks(p, end);
+
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	if (p >= end || (unsigned)(*p - '0') >= 10)
+		return NULL;
+
+	long long v = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; ++p)
+		v = v*10 + (*p - '0');
+
+	*out = neg ? -v : v;
+	return p;
+}
+
+static size_t line_number(const char* data, const char* p)
+{
+	size_t n = 1;
+	for (const char* c = data; c < p; ++c)
+		n += *c == '\n';
+	return n;
+}
+
+
+/*
+ * OBJ
+ */
+
+//Negative (relative) indices can't be resolved until the earlier pieces
+//have been counted, so they're stored biased relative to the piece's first
+//element and fixed up after the join.
+static const long long OBJ_RELATIVE = 1LL << 40;
+static const long long OBJ_MISSING = -1;
+
+struct ObjChunk
+{
+	std::vector<float> v, vt, vn;
+	std::vector<long long> corners;		//v, vt, vn for each triangle corner
+	const char* error;			//start of the bad line
+};
+
+static inline long long obj_index(long long raw, size_t local_count)
+{
+	if (raw > 0)
+		return raw - 1;
+	return OBJ_RELATIVE + (long long)local_count + raw;	//raw == 0 is caught by the caller
+}
+
+static void parse_obj_chunk(const char* p, const char* end, ObjChunk& c)
+{
+	long long poly[3*64];
+	c.error = NULL;
+
+	while (p < end) {
+		const char* line = p;
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		p = skip_blanks(p, eol);
+
+		if (eol - p > 2 && p[0] == 'v') {
+			float f[3];
+			if (is_blank(p[1])) {
+				if (!(p = parse_float(p+1, eol, &f[0])) || !(p = parse_float(p, eol, &f[1])) || !(p = parse_float(p, eol, &f[2])))
+					goto bad;
+				c.v.insert(c.v.end(), f, f+3);
+			} else if (p[1] == 'n' && is_blank(p[2])) {
+				if (!(p = parse_float(p+2, eol, &f[0])) || !(p = parse_float(p, eol, &f[1])) || !(p = parse_float(p, eol, &f[2])))
+					goto bad;
+				c.vn.insert(c.vn.end(), f, f+3);
+			} else if (p[1] == 't' && is_blank(p[2])) {
+				if (!(p = parse_float(p+2, eol, &f[0])))
+					goto bad;
+				if (!parse_float(p, eol, &f[1]))
+					f[1] = 0.0f;
+				c.vt.insert(c.vt.end(), f, f+2);
+			}
+		} else if (eol - p > 2 && p[0] == 'f' && is_blank(p[1])) {
+			int n = 0;
+			++p;
+			while ((p = skip_blanks(p, eol)) < eol) {
+				if (n == 64)
+					goto bad;
+
+				long long* corner = &poly[3*n];
+				long long raw;
+				if (!(p = parse_int(p, eol, &raw)) || !raw)
+					goto bad;
+				corner[0] = obj_index(raw, c.v.size() / 3);
+				corner[1] = corner[2] = OBJ_MISSING;
+
+				if (p < eol && *p == '/') {
+					++p;
+					if (p < eol && *p != '/') {
+						if (!(p = parse_int(p, eol, &raw)) || !raw)
+							goto bad;
+						corner[1] = obj_index(raw, c.vt.size() / 2);
+					}
+					if (p < eol && *p == '/') {
+						if (!(p = parse_int(p+1, eol, &raw)) || !raw)
+							goto bad;
+						corner[2] = obj_index(raw, c.vn.size() / 3);
+					}
+				}
+				++n;
+			}
+			if (n < 3)
+				goto bad;
+
+			for (int i=1; i+1<n; ++i) {
+				c.corners.insert(c.corners.end(), &poly[0], &poly[3]);
+				c.corners.insert(c.corners.end(), &poly[3*i], &poly[3*i+6]);
+			}
+		}
+
+		p = eol + 1;
+		continue;
+
+	bad:
+		c.error = line;
+		return;
+	}
+}
+
+static inline GLuint obj_resolve(long long x, size_t base, size_t count, bool& ok)
+{
+	if (x == OBJ_MISSING)
+		return ~0u;
+	if (x >= OBJ_RELATIVE / 2)
+		x = x - OBJ_RELATIVE + (long long)base;
+	if (x < 0 || (size_t)x >= count) {
+		ok = false;
+		return 0;
+	}
+	return (GLuint)x;
+}
+
+static inline size_t corner_hash(const GLuint* c)
+{
+	size_t h = c[0] * 73856093u;
+	h ^= c[1] * 19349663u;
+	h ^= c[2] * 83492791u;
+	return h;
+}
+
+
+ObjImporter::ObjImporter()
+{
+	has_faces = false;
+}
+
+
+bool ObjImporter::parse(const char* path, unsigned int threads)
+{
+	positions.clear();
+	texcoords.clear();
+	normals.clear();
+	corners.clear();
+	tri_indices.clear();
+	has_faces = false;
+
+	MappedFile file;
+	if (!file.open(path)) {
+		fprintf(stderr, "obj import: can't open %s\n", path);
+		return false;
+	}
+
+	const char* data = (const char*)file.data;
+	size_t size = file.size;
+
+	std::vector<ObjChunk> chunks(worker_count(threads));
+	unsigned int used = parallel_for(size, threads, IMPORT_MIN_CHUNK, [&](unsigned int t, size_t begin, size_t end) {
+		begin = line_boundary(data, size, begin);
+		end = line_boundary(data, size, end);
+		parse_obj_chunk(data + begin, data + end, chunks[t]);
+	});
+	chunks.resize(used);
+
+	//every piece's first v/vt/vn and triangle corner
+	std::vector<size_t> v_base(used), vt_base(used), vn_base(used), c_base(used);
+	size_t nv = 0, nvt = 0, nvn = 0, nc = 0;
+	for (unsigned int i=0; i<used; ++i) {
+		if (chunks[i].error) {
+			fprintf(stderr, "obj import: %s:%lu: can't parse line\n", path, (unsigned long)line_number(data, chunks[i].error));
+			return false;
+		}
+		v_base[i] = nv;
+		vt_base[i] = nvt;
+		vn_base[i] = nvn;
+		c_base[i] = nc;
+		nv += chunks[i].v.size() / 3;
+		nvt += chunks[i].vt.size() / 2;
+		nvn += chunks[i].vn.size() / 3;
+		nc += chunks[i].corners.size() / 3;
+	}
+
+	positions.resize(nv*3);
+	texcoords.resize(nvt*2);
+	normals.resize(nvn*3);
+	std::vector<GLuint> resolved(nc*3);
+
+	//gather and resolve indices per piece, again in parallel
+	std::vector<char> ok(used, 1);
+	parallel_for(used, used, 1, [&](unsigned int, size_t begin, size_t end) {
+		for (size_t i=begin; i<end; ++i) {
+			ObjChunk& c = chunks[i];
+			if (!c.v.empty())
+				memcpy(&positions[v_base[i]*3], &c.v[0], c.v.size()*sizeof(float));
+			if (!c.vt.empty())
+				memcpy(&texcoords[vt_base[i]*2], &c.vt[0], c.vt.size()*sizeof(float));
+			if (!c.vn.empty())
+				memcpy(&normals[vn_base[i]*3], &c.vn[0], c.vn.size()*sizeof(float));
+
+			bool good = true;
+			GLuint* out = resolved.empty() ? NULL : &resolved[c_base[i]*3];
+			for (size_t j=0; j<c.corners.size(); j+=3) {
+				out[j]   = obj_resolve(c.corners[j],   v_base[i],  nv,  good);
+				out[j+1] = obj_resolve(c.corners[j+1], vt_base[i], nvt, good);
+				out[j+2] = obj_resolve(c.corners[j+2], vn_base[i], nvn, good);
+			}
+			ok[i] = good;
+
+			std::vector<float>().swap(c.v);
+			std::vector<float>().swap(c.vt);
+			std::vector<float>().swap(c.vn);
+			std::vector<long long>().swap(c.corners);
+		}
+	});
+
+	for (unsigned int i=0; i<used; ++i) {
+		if (!ok[i]) {
+			fprintf(stderr, "obj import: %s: face index out of range\n", path);
+			return false;
+		}
+	}
+
+	//A file with no faces is just its positions
+	has_faces = nc != 0;
+	if (!nc) {
+		corners.resize(nv*3, ~0u);
+		for (size_t i=0; i<nv; ++i)
+			corners[i*3] = i;
+		return true;
+	}
+
+	//Same v/vt/vn triple is the same vertex, open addressing like weld_vertices
+	size_t table_size = 1;
+	while (table_size < nc*2)
+		table_size *= 2;
+	std::vector<GLuint> table(table_size, ~0u);
+
+	corners.reserve(nv*3);
+	tri_indices.resize(nc);
+	for (size_t i=0; i<nc; ++i) {
+		const GLuint* c = &resolved[i*3];
+		size_t slot = corner_hash(c) & (table_size - 1);
+		while (1) {
+			GLuint u = table[slot];
+			if (u == ~0u) {
+				u = corners.size() / 3;
+				table[slot] = u;
+				corners.insert(corners.end(), c, c+3);
+				tri_indices[i] = u;
+				break;
+			}
+			if (!memcmp(&corners[u*3], c, 3*sizeof(GLuint))) {
+				tri_indices[i] = u;
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+
+	return true;
+}
+
+
+bool ObjImporter::fill(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads)
+{
+	parallel_for(vertex_count(), threads, IMPORT_MIN_CHUNK / 16, [&](unsigned int, size_t begin, size_t end) {
+		float slots[SLOT_COUNT];
+		memcpy(slots, default_slots, sizeof(slots));
+		for (size_t i=begin; i<end; ++i) {
+			const GLuint* c = &corners[i*3];
+			memcpy(&slots[SLOT_POS], &positions[c[0]*3], 3*sizeof(float));
+			if (c[1] != ~0u)
+				memcpy(&slots[SLOT_TEX], &texcoords[c[1]*2], 2*sizeof(float));
+			else
+				slots[SLOT_TEX] = slots[SLOT_TEX+1] = 0.0f;
+			if (c[2] != ~0u)
+				memcpy(&slots[SLOT_NORMAL], &normals[c[2]*3], 3*sizeof(float));
+			else
+				slots[SLOT_NORMAL] = slots[SLOT_NORMAL+1] = slots[SLOT_NORMAL+2] = 0.0f;
+			store_vertex(sink, i, slots);
+		}
+	});
+
+	indices.swap(tri_indices);
+	tri_indices.clear();
+	return true;
+}
+
+
+/*
+ * PLY
+ */
+
+enum { PLY_ASCII, PLY_BINARY_LE, PLY_BINARY_BE };
+
+enum { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+static const size_t ply_type_size[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+static int ply_type(const std::string& s)
+{
+	static const char* names[][2] =
+	{
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+	};
+	for (int i=0; i<8; ++i)
+		if (s == names[i][0] || s == names[i][1])
+			return i;
+	return -1;
+}
+
+//which slot a vertex property goes in, -1 to skip it
+static int ply_slot(const std::string& name)
+{
+	static const char* names[][2] =
+	{
+		{ "x", "x" }, { "y", "y" }, { "z", "z" },
+		{ "nx", "nx" }, { "ny", "ny" }, { "nz", "nz" },
+		{ "u", "s" }, { "v", "t" },
+		{ "red", "r" }, { "green", "g" }, { "blue", "b" }, { "alpha", "a" }
+	};
+	for (int i=0; i<SLOT_COUNT; ++i)
+		if (name == names[i][0] || name == names[i][1])
+			return i;
+	if (name == "texture_u")
+		return SLOT_TEX;
+	if (name == "texture_v")
+		return SLOT_TEX + 1;
+	return -1;
+}
+
+//integer colors are normalized
+static float ply_scale(int slot, int type)
+{
+	if (slot >= SLOT_COLOR) {
+		if (type == PLY_UINT8)
+			return 1.0f / 255.0f;
+		if (type == PLY_UINT16)
+			return 1.0f / 65535.0f;
+	}
+	return 1.0f;
+}
+
+static double ply_read(const unsigned char* p, int type, bool swap)
+{
+	unsigned char b[8];
+	size_t n = ply_type_size[type];
+	for (size_t i=0; i<n; ++i)
+		b[i] = swap ? p[n-1-i] : p[i];
+
+	switch (type) {
+	case PLY_INT8:    return (signed char)b[0];
+	case PLY_UINT8:   return b[0];
+	case PLY_INT16:   { short v;          memcpy(&v, b, 2); return v; }
+	case PLY_UINT16:  { unsigned short v; memcpy(&v, b, 2); return v; }
+	case PLY_INT32:   { int v;            memcpy(&v, b, 4); return v; }
+	case PLY_UINT32:  { unsigned int v;   memcpy(&v, b, 4); return v; }
+	case PLY_FLOAT32: { float v;          memcpy(&v, b, 4); return v; }
+	default:          { double v;         memcpy(&v, b, 8); return v; }
+	}
+}
+
+static inline bool is_little_endian()
+{
+	unsigned int x = 1;
+	return *(unsigned char*)&x == 1;
+}
+
+static inline bool is_face_list(const PlyImporter::Property& p)
+{
+	return p.count_type >= 0 && (p.name == "vertex_indices" || p.name == "vertex_index");
+}
+
+//fans one polygon into tris, false if an index is out of range
+static inline bool ply_add_face(const long long* poly, size_t n, size_t vcount, std::vector<GLuint>& tris)
+{
+	for (size_t i=0; i<n; ++i)
+		if (poly[i] < 0 || (size_t)poly[i] >= vcount)
+			return false;
+	for (size_t i=1; i+1<n; ++i) {
+		tris.push_back(poly[0]);
+		tris.push_back(poly[i]);
+		tris.push_back(poly[i+1]);
+	}
+	return true;
+}
+
+
+PlyImporter::PlyImporter()
+{
+	body = 0;
+	format = PLY_ASCII;
+	has_faces = false;
+}
+
+size_t PlyImporter::vertex_count() const
+{
+	for (size_t i=0; i<elements.size(); ++i)
+		if (elements[i].name == "vertex")
+			return elements[i].count;
+	return 0;
+}
+
+
+bool PlyImporter::parse(const char* path, unsigned int)
+{
+	elements.clear();
+	has_faces = false;
+
+	if (!file.open(path)) {
+		fprintf(stderr, "ply import: can't open %s\n", path);
+		return false;
+	}
+
+	const char* data = (const char*)file.data;
+	const char* end = data + file.size;
+	if (file.size < 4 || memcmp(data, "ply", 3) || (data[3] != '\n' && data[3] != '\r')) {
+		fprintf(stderr, "ply import: %s isn't a PLY file\n", path);
+		return false;
+	}
+
+	const char* p = data;
+	bool have_format = false;
+	while (1) {
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol) {
+			fprintf(stderr, "ply import: %s: no end_header\n", path);
+			return false;
+		}
+
+		const char* line = p;
+		std::vector<std::string> words;
+		for (const char* w = skip_blanks(p, eol); w < eol; w = skip_blanks(w, eol)) {
+			const char* we = w;
+			while (we < eol && !is_blank(*we))
+				++we;
+			words.push_back(std::string(w, we));
+			w = we;
+		}
+		p = eol + 1;
+
+		if (words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+			continue;
+
+		if (words[0] == "end_header")
+			break;
+
+		bool ok = true;
+		if (words[0] == "format" && words.size() >= 2) {
+			if (words[1] == "ascii")
+				format = PLY_ASCII;
+			else if (words[1] == "binary_little_endian")
+				format = PLY_BINARY_LE;
+			else if (words[1] == "binary_big_endian")
+				format = PLY_BINARY_BE;
+			else
+				ok = false;
+			have_format = true;
+		} else if (words[0] == "element" && words.size() == 3) {
+			Element e;
+			e.name = words[1];
+			e.count = strtoul(words[2].c_str(), NULL, 10);
+			elements.push_back(e);
+		} else if (words[0] == "property" && !elements.empty()) {
+			Property prop;
+			if (words.size() == 5 && words[1] == "list") {
+				prop.count_type = ply_type(words[2]);
+				prop.type = ply_type(words[3]);
+				prop.name = words[4];
+				ok = prop.count_type >= 0 && prop.count_type <= PLY_UINT32;
+			} else if (words.size() == 3) {
+				prop.count_type = -1;
+				prop.type = ply_type(words[1]);
+				prop.name = words[2];
+			} else {
+				ok = false;
+			}
+			ok = ok && prop.type >= 0;
+			elements.back().props.push_back(prop);
+		} else {
+			ok = false;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "ply import: %s: bad header line \"%s\"\n", path, std::string(line, eol).c_str());
+			return false;
+		}
+	}
+	body = p - data;
+
+	if (!have_format) {
+		fprintf(stderr, "ply import: %s: no format line\n", path);
+		return false;
+	}
+
+	bool have_vertex = false;
+	for (size_t i=0; i<elements.size(); ++i) {
+		const Element& e = elements[i];
+		if (e.name == "vertex") {
+			for (size_t j=0; j<e.props.size(); ++j) {
+				if (e.props[j].count_type >= 0) {
+					fprintf(stderr, "ply import: %s: list properties in vertex aren't supported\n", path);
+					return false;
+				}
+			}
+			have_vertex = true;
+		} else if (e.name == "face") {
+			for (size_t j=0; j<e.props.size(); ++j)
+				has_faces = has_faces || (is_face_list(e.props[j]) && e.count);
+		}
+	}
+	if (!have_vertex) {
+		fprintf(stderr, "ply import: %s: no vertex element\n", path);
+		return false;
+	}
+
+	//Every record takes at least a byte of text, or in binary its fixed
+	//properties and list counts.  A count the body can't hold is a broken
+	//header, caught before fill() sizes anything by it.
+	size_t left = file.size - body;
+	for (size_t i=0; i<elements.size(); ++i) {
+		const Element& e = elements[i];
+		size_t min_size = 0;
+		for (size_t j=0; j<e.props.size() && format != PLY_ASCII; ++j)
+			min_size += ply_type_size[e.props[j].count_type >= 0 ? e.props[j].count_type : e.props[j].type];
+		if (!min_size)
+			min_size = 1;
+		if (e.count > left / min_size) {
+			fprintf(stderr, "ply import: %s: %lu %s records don't fit in the file\n", path, (unsigned long)e.count, e.name.c_str());
+			return false;
+		}
+		left -= e.count * min_size;
+	}
+
+	return true;
+}
+
+
+bool PlyImporter::fill(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads)
+{
+	bool ok = format == PLY_ASCII ? fill_ascii(sink, indices, threads) : fill_binary(sink, indices, threads);
+	file.close();
+	if (!ok)
+		fprintf(stderr, "ply import: bad or truncated data\n");
+	return ok;
+}
+
+
+//Text body: every non blank line is one element record, in header order.
+//Each thread counts the records in its piece, then with the prefix sums
+//knows which element (and which vertex) each of its lines is.
+bool PlyImporter::fill_ascii(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads)
+{
+	const char* data = (const char*)file.data + body;
+	size_t size = file.size - body;
+	size_t vcount = vertex_count();
+
+	unsigned int n = worker_count(threads);
+	std::vector<size_t> first_record(n + 1, 0);
+	std::vector< std::vector<GLuint> > tris(n);
+	std::vector<char> ok(n, 1);
+
+	//record index where each element starts
+	std::vector<size_t> elem_start(elements.size() + 1, 0);
+	for (size_t i=0; i<elements.size(); ++i)
+		elem_start[i+1] = elem_start[i] + elements[i].count;
+
+	//The two passes need the same split, parallel_for's ranges depend only on
+	//size, threads and min chunk so running it twice gives the same pieces.
+	unsigned int used = parallel_for(size, threads, IMPORT_MIN_CHUNK, [&](unsigned int t, size_t begin, size_t end) {
+		const char* p = data + line_boundary(data, size, begin);
+		const char* e = data + line_boundary(data, size, end);
+		size_t records = 0;
+		while (p < e) {
+			const char* eol = (const char*)memchr(p, '\n', e - p);
+			if (!eol)
+				eol = e;
+			records += skip_blanks(p, eol) != eol;
+			p = eol + 1;
+		}
+		first_record[t+1] = records;
+	});
+	for (unsigned int t=0; t<used; ++t)
+		first_record[t+1] += first_record[t];
+
+	if (first_record[used] < elem_start[elements.size()])
+		return false;
+
+	parallel_for(size, threads, IMPORT_MIN_CHUNK, [&](unsigned int t, size_t begin, size_t end) {
+		const char* p = data + line_boundary(data, size, begin);
+		const char* e = data + line_boundary(data, size, end);
+		size_t record = first_record[t];
+		size_t elem = 0;
+		long long poly[256];
+
+		float slots[SLOT_COUNT];
+		memcpy(slots, default_slots, sizeof(slots));
+
+		for (; p < e; p += 1) {
+			const char* eol = (const char*)memchr(p, '\n', e - p);
+			if (!eol)
+				eol = e;
+			const char* q = skip_blanks(p, eol);
+			if (q == eol) {
+				p = eol;
+				continue;
+			}
+
+			while (elem < elements.size() && record >= elem_start[elem+1])
+				++elem;
+			if (elem == elements.size())
+				break;		//trailing junk
+
+			const Element& el = elements[elem];
+			if (el.name == "vertex") {
+				for (size_t j=0; j<el.props.size(); ++j) {
+					float f;
+					if (!(q = parse_float(q, eol, &f))) {
+						ok[t] = 0;
+						return;
+					}
+					int slot = ply_slot(el.props[j].name);
+					if (slot >= 0)
+						slots[slot] = f * ply_scale(slot, el.props[j].type);
+				}
+				store_vertex(sink, record - elem_start[elem], slots);
+			} else if (el.name == "face") {
+				for (size_t j=0; j<el.props.size(); ++j) {
+					const Property& prop = el.props[j];
+					long long count = 1;
+					if (prop.count_type >= 0 && !(q = parse_int(q, eol, &count)))
+						count = -1;
+					if (count < 0 || (is_face_list(prop) && count > 256)) {
+						ok[t] = 0;
+						return;
+					}
+					for (long long k=0; k<count; ++k) {
+						float f;
+						const char* r = is_face_list(prop) ? parse_int(q, eol, &poly[k]) : parse_float(q, eol, &f);
+						if (!r) {
+							ok[t] = 0;
+							return;
+						}
+						q = r;
+					}
+					if (is_face_list(prop) && !ply_add_face(poly, count, vcount, tris[t])) {
+						ok[t] = 0;
+						return;
+					}
+				}
+			}
+			++record;
+			p = eol;
+		}
+	});
+
+	size_t total = 0;
+	for (unsigned int t=0; t<used; ++t) {
+		if (!ok[t])
+			return false;
+		total += tris[t].size();
+	}
+
+	indices.clear();
+	indices.reserve(total);
+	for (unsigned int t=0; t<used; ++t)
+		indices.insert(indices.end(), tris[t].begin(), tris[t].end());
+	return true;
+}
+
+
+//Fixed size records (the vertex element) are converted in parallel, elements
+//with lists have to be walked to find where each record starts.
+bool PlyImporter::fill_binary(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads)
+{
+	const unsigned char* p = file.data + body;
+	const unsigned char* end = file.data + file.size;
+	bool swap = (format == PLY_BINARY_LE) != is_little_endian();
+	size_t vcount = vertex_count();
+
+	indices.clear();
+	std::vector<long long> poly;
+
+	for (size_t i=0; i<elements.size(); ++i) {
+		const Element& el = elements[i];
+
+		size_t record_size = 0;
+		bool fixed = true;
+		for (size_t j=0; j<el.props.size(); ++j) {
+			fixed = fixed && el.props[j].count_type < 0;
+			record_size += ply_type_size[el.props[j].type];
+		}
+
+		if (fixed) {
+			if ((size_t)(end - p) / (record_size ? record_size : 1) < el.count)
+				return false;
+
+			if (el.name == "vertex") {
+				std::vector<int> slot(el.props.size());
+				std::vector<size_t> offset(el.props.size());
+				for (size_t j=0, off=0; j<el.props.size(); off += ply_type_size[el.props[j].type], ++j) {
+					slot[j] = ply_slot(el.props[j].name);
+					offset[j] = off;
+				}
+
+				const unsigned char* records = p;
+				parallel_for(el.count, threads, IMPORT_MIN_CHUNK / 16, [&](unsigned int, size_t begin, size_t end) {
+					float slots[SLOT_COUNT];
+					memcpy(slots, default_slots, sizeof(slots));
+					for (size_t v=begin; v<end; ++v) {
+						const unsigned char* r = records + v*record_size;
+						for (size_t j=0; j<slot.size(); ++j) {
+							if (slot[j] >= 0) {
+								int type = el.props[j].type;
+								slots[slot[j]] = (float)ply_read(r + offset[j], type, swap) * ply_scale(slot[j], type);
+							}
+						}
+						store_vertex(sink, v, slots);
+					}
+				});
+			}
+			p += el.count * record_size;
+			continue;
+		}
+
+		//only a guess, no more than a byte of the file per index however big
+		//the header says the element is
+		bool face = el.name == "face";
+		if (face)
+			indices.reserve(std::min(el.count * 3, (size_t)(end - p)));
+
+		for (size_t r=0; r<el.count; ++r) {
+			for (size_t j=0; j<el.props.size(); ++j) {
+				const Property& prop = el.props[j];
+				size_t tsize = ply_type_size[prop.type];
+				if (prop.count_type < 0) {
+					if ((size_t)(end - p) < tsize)
+						return false;
+					p += tsize;
+					continue;
+				}
+
+				size_t csize = ply_type_size[prop.count_type];
+				if ((size_t)(end - p) < csize)
+					return false;
+				size_t count = (size_t)ply_read(p, prop.count_type, swap);
+				p += csize;
+				if ((size_t)(end - p) / tsize < count)
+					return false;
+
+				if (face && is_face_list(prop)) {
+					poly.resize(count);
+					for (size_t k=0; k<count; ++k)
+						poly[k] = (long long)ply_read(p + k*tsize, prop.type, swap);
+					if (count && !ply_add_face(&poly[0], count, vcount, indices))
+						return false;
+				}
+				p += count * tsize;
+			}
+		}
+	}
+
+	return true;
+}
+
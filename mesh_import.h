@@ -0,0 +1,156 @@
+/*
+ *Multithreaded OBJ and PLY loading straight into a Mesh
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_IMPORT_H
+#define MESH_IMPORT_H
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+
+#include "Mesh.h"
+#include "mapped_file.h"
+
+
+//Where the importers write each attribute of a vertex, any offset can be
+//NOT_PRESENT.  Built from the vertex_format so the non template parsing code
+//can fill Mesh::verts directly.
+struct VertexSink
+{
+	static const size_t NOT_PRESENT = size_t(-1);
+
+	unsigned char* base;
+	size_t stride;
+	size_t pos, normal, tex, color;
+	int normal_components, tex_components, color_components;
+};
+
+template<class Vertex, class Alloc>
+VertexSink make_vertex_sink(std::vector<Vertex, Alloc>& verts)
+{
+	typedef typename vertex_format<Vertex>::layout layout;
+
+	VertexSink s;
+	s.base = verts.empty() ? NULL : (unsigned char*)&verts[0];
+	s.stride = sizeof(Vertex);
+	s.pos = layout::offset_of(ATTRIBUTE_VERTEX);
+	s.normal = layout::offset_of(ATTRIBUTE_NORMAL);
+	s.tex = layout::offset_of(ATTRIBUTE_TEXCOORD);
+	s.color = layout::offset_of(ATTRIBUTE_COLOR);
+	s.normal_components = layout::components_of(ATTRIBUTE_NORMAL);
+	s.tex_components = layout::components_of(ATTRIBUTE_TEXCOORD);
+	s.color_components = layout::components_of(ATTRIBUTE_COLOR);
+	return s;
+}
+
+
+//Wavefront OBJ, v/vt/vn and f only (polygons are fanned into triangles,
+//negative indices work).  The mapped file is split at line boundaries and
+//each piece is parsed on its own thread; unique v/vt/vn corners become the
+//vertices and indices exactly like weld() would produce.  A file without
+//faces loads as GL_POINTS.
+class ObjImporter
+{
+public:
+	ObjImporter();
+
+	bool parse(const char* path, unsigned int threads = 0);
+
+	size_t vertex_count() const { return corners.size() / 3; }
+	GLenum primitive() const { return has_faces ? GL_TRIANGLES : GL_POINTS; }
+
+	//sink must have room for vertex_count() vertices, indices are swapped out
+	bool fill(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads = 0);
+
+private:
+	std::vector<float> positions, texcoords, normals;
+	std::vector<GLuint> corners;		//v, vt, vn per unique vertex, ~0 if missing
+	std::vector<GLuint> tri_indices;
+	bool has_faces;
+};
+
+
+//Stanford PLY, ascii and binary (either endianness).  Reads the vertex
+//element (x y z, nx ny nz, u v / s t, red green blue alpha) and the face
+//element's vertex_indices list, anything else is skipped.  A file without
+//faces loads as GL_POINTS.
+class PlyImporter
+{
+public:
+	PlyImporter();
+
+	bool parse(const char* path, unsigned int threads = 0);
+
+	size_t vertex_count() const;
+	GLenum primitive() const { return has_faces ? GL_TRIANGLES : GL_POINTS; }
+
+	//sink must have room for vertex_count() vertices, faces are triangulated into indices
+	bool fill(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads = 0);
+
+	struct Property
+	{
+		std::string name;
+		int type;		//PLY_* in mesh_import.cpp
+		int count_type;		//-1 unless it's a list
+	};
+
+	struct Element
+	{
+		std::string name;
+		size_t count;
+		std::vector<Property> props;
+	};
+
+private:
+	MappedFile file;
+	size_t body;			//offset of the first byte after end_header
+	int format;
+	std::vector<Element> elements;
+	bool has_faces;
+
+	bool fill_ascii(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads);
+	bool fill_binary(const VertexSink& sink, std::vector<GLuint>& indices, unsigned int threads);
+};
+
+
+//Fills mesh from a parsed importer.  The vertex storage is sized once and
+//the parsers write straight into it; the mesh is left indexed (unless it's
+//a point cloud) and ready for end().
+template<class Importer, class Vertex, class Alloc>
+bool import_mesh(Importer& importer, const char* path, Mesh<Vertex, Alloc>& mesh, unsigned int threads = 0)
+{
+	if (!importer.parse(path, threads))
+		return false;
+
+	mesh.clear();
+	mesh.primitive = importer.primitive();
+	mesh.verts.resize(importer.vertex_count());
+
+	if (!importer.fill(make_vertex_sink(mesh.verts), mesh.indices, threads)) {
+		mesh.clear();
+		return false;
+	}
+
+	mesh.indexed = !mesh.indices.empty();
+	return true;
+}
+
+template<class Vertex, class Alloc>
+bool load_obj(const char* path, Mesh<Vertex, Alloc>& mesh, unsigned int threads = 0)
+{
+	ObjImporter obj;
+	return import_mesh(obj, path, mesh, threads);
+}
+
+template<class Vertex, class Alloc>
+bool load_ply(const char* path, Mesh<Vertex, Alloc>& mesh, unsigned int threads = 0)
+{
+	PlyImporter ply;
+	return import_mesh(ply, path, mesh, threads);
+}
+
+
+#endif
+
@@ -0,0 +1,210 @@
+/*
+ *Smooth normal and tangent generation
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_normals.h"
+#include "parallel.h"
+
+#include <vector>
+#include <string.h>
+#include <math.h>
+#include <glm/glm.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+//triangles per thread worth the overhead
+#define NORMALS_MIN_ITEMS	(1 << 14)
+
+
+static inline const float* attrib(const unsigned char* verts, size_t stride, size_t offset, GLuint i)
+{
+	return (const float*)(verts + i*stride + offset);
+}
+
+static inline glm::vec3 safe_normalize(const glm::vec3& v)
+{
+	float l2 = glm::dot(v, v);
+	return l2 > 0.0f ? v / sqrtf(l2) : v;
+}
+
+
+//Unnormalized cross products (twice the area) of triangles [begin, end).
+//4 at a time with SSE: gather the corners into x, y and z registers so one
+//cross product covers 4 triangles.
+static void face_normals(glm::vec3* out, const GLuint* indices, size_t begin, size_t end,
+                         const unsigned char* verts, size_t stride, size_t pos_offset)
+{
+	size_t t = begin;
+#ifdef __SSE2__
+	for (; t+4 <= end; t+=4) {
+		float c[9][4];		//ax ay az bx by bz cx cy cz for each of the 4
+		for (int k=0; k<4; ++k) {
+			const GLuint* tri = &indices[(t+k)*3];
+			for (int v=0; v<3; ++v) {
+				const float* p = attrib(verts, stride, pos_offset, tri[v]);
+				c[v*3][k] = p[0];
+				c[v*3+1][k] = p[1];
+				c[v*3+2][k] = p[2];
+			}
+		}
+		__m128 ax = _mm_loadu_ps(c[0]), ay = _mm_loadu_ps(c[1]), az = _mm_loadu_ps(c[2]);
+		__m128 e1x = _mm_sub_ps(_mm_loadu_ps(c[3]), ax);
+		__m128 e1y = _mm_sub_ps(_mm_loadu_ps(c[4]), ay);
+		__m128 e1z = _mm_sub_ps(_mm_loadu_ps(c[5]), az);
+		__m128 e2x = _mm_sub_ps(_mm_loadu_ps(c[6]), ax);
+		__m128 e2y = _mm_sub_ps(_mm_loadu_ps(c[7]), ay);
+		__m128 e2z = _mm_sub_ps(_mm_loadu_ps(c[8]), az);
+
+		float n[3][4];
+		_mm_storeu_ps(n[0], _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+		_mm_storeu_ps(n[1], _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+		_mm_storeu_ps(n[2], _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+		for (int k=0; k<4; ++k)
+			out[t+k] = glm::vec3(n[0][k], n[1][k], n[2][k]);
+	}
+#endif
+	for (; t<end; ++t) {
+		const GLuint* tri = &indices[t*3];
+		glm::vec3 a, b, c;
+		memcpy(&a, attrib(verts, stride, pos_offset, tri[0]), sizeof(a));
+		memcpy(&b, attrib(verts, stride, pos_offset, tri[1]), sizeof(b));
+		memcpy(&c, attrib(verts, stride, pos_offset, tri[2]), sizeof(c));
+		out[t] = glm::cross(b - a, c - a);
+	}
+}
+
+
+//triangles using each vertex, offsets has vcount+1 entries
+static void vertex_triangles(std::vector<GLuint>& offsets, std::vector<GLuint>& tris,
+                             const GLuint* indices, size_t icount, size_t vcount)
+{
+	offsets.assign(vcount + 1, 0);
+	for (size_t i=0; i<icount; ++i)
+		offsets[indices[i] + 1]++;
+	for (size_t v=0; v<vcount; ++v)
+		offsets[v+1] += offsets[v];
+
+	tris.resize(icount);
+	std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i=0; i<icount; ++i)
+		tris[fill[indices[i]]++] = i / 3;
+}
+
+
+void compute_normals(void* verts, size_t vcount, size_t stride, size_t pos_offset, size_t normal_offset,
+                     const GLuint* indices, size_t icount, unsigned int threads)
+{
+	//parallel_for still runs the body once for an empty range
+	if (icount < 3)
+		return;
+
+	unsigned char* data = (unsigned char*)verts;
+	size_t tcount = icount / 3;
+
+	std::vector<glm::vec3> faces(tcount);
+	parallel_for(tcount, threads, NORMALS_MIN_ITEMS, [&](unsigned int, size_t begin, size_t end) {
+		face_normals(&faces[0], indices, begin, end, data, stride, pos_offset);
+	});
+
+	std::vector<GLuint> offsets, tris;
+	vertex_triangles(offsets, tris, indices, tcount*3, vcount);
+
+	parallel_for(vcount, threads, NORMALS_MIN_ITEMS, [&](unsigned int, size_t begin, size_t end) {
+		for (size_t v=begin; v<end; ++v) {
+			glm::vec3 n(0.0f);
+			for (GLuint j=offsets[v]; j<offsets[v+1]; ++j)
+				n += faces[tris[j]];
+			n = safe_normalize(n);
+			memcpy(data + v*stride + normal_offset, &n, sizeof(n));
+		}
+	});
+}
+
+
+//uv derived tangent and bitangent of one triangle plus the angle at each corner
+struct FaceTangent
+{
+	glm::vec3 s, t;
+	float angle[3];
+};
+
+static void face_tangent(FaceTangent& f, const unsigned char* verts, size_t stride, size_t pos_offset,
+                         size_t tex_offset, const GLuint* tri)
+{
+	glm::vec3 p[3];
+	glm::vec2 uv[3];
+	for (int k=0; k<3; ++k) {
+		memcpy(&p[k], attrib(verts, stride, pos_offset, tri[k]), sizeof(p[k]));
+		memcpy(&uv[k], attrib(verts, stride, tex_offset, tri[k]), sizeof(uv[k]));
+	}
+
+	for (int k=0; k<3; ++k) {
+		glm::vec3 a = safe_normalize(p[(k+1)%3] - p[k]);
+		glm::vec3 b = safe_normalize(p[(k+2)%3] - p[k]);
+		float d = glm::dot(a, b);
+		f.angle[k] = acosf(d < -1.0f ? -1.0f : (d > 1.0f ? 1.0f : d));
+	}
+
+	glm::vec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+	glm::vec2 d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+	float r = d1.x*d2.y - d2.x*d1.y;
+	if (r == 0.0f) {
+		f.s = f.t = glm::vec3(0.0f);	//no uv area, contributes nothing
+		return;
+	}
+	float sign = r > 0.0f ? 1.0f : -1.0f;
+	f.s = safe_normalize((e1*d2.y - e2*d1.y) * sign);
+	f.t = safe_normalize((e2*d1.x - e1*d2.x) * sign);
+}
+
+
+void compute_tangents(void* verts, size_t vcount, size_t stride, size_t pos_offset, size_t normal_offset,
+                      size_t tex_offset, size_t tangent_offset, const GLuint* indices, size_t icount,
+                      unsigned int threads)
+{
+	if (icount < 3)
+		return;
+
+	unsigned char* data = (unsigned char*)verts;
+	size_t tcount = icount / 3;
+
+	std::vector<FaceTangent> faces(tcount);
+	parallel_for(tcount, threads, NORMALS_MIN_ITEMS, [&](unsigned int, size_t begin, size_t end) {
+		for (size_t t=begin; t<end; ++t)
+			face_tangent(faces[t], data, stride, pos_offset, tex_offset, &indices[t*3]);
+	});
+
+	std::vector<GLuint> offsets, tris;
+	vertex_triangles(offsets, tris, indices, tcount*3, vcount);
+
+	parallel_for(vcount, threads, NORMALS_MIN_ITEMS, [&](unsigned int, size_t begin, size_t end) {
+		for (size_t v=begin; v<end; ++v) {
+			glm::vec3 n;
+			memcpy(&n, attrib(data, stride, normal_offset, v), sizeof(n));
+
+			glm::vec3 s(0.0f), t(0.0f);
+			for (GLuint j=offsets[v]; j<offsets[v+1]; ++j) {
+				const FaceTangent& f = faces[tris[j]];
+				const GLuint* tri = &indices[tris[j]*3];
+				float w = f.angle[tri[0] == v ? 0 : (tri[1] == v ? 1 : 2)];
+				s += safe_normalize(f.s - n*glm::dot(n, f.s)) * w;
+				t += safe_normalize(f.t - n*glm::dot(n, f.t)) * w;
+			}
+
+			s = safe_normalize(s - n*glm::dot(n, s));
+			if (glm::dot(s, s) == 0.0f) {
+				//no usable uvs, any vector in the tangent plane will do
+				glm::vec3 axis = fabsf(n.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+				s = safe_normalize(axis - n*glm::dot(n, axis));
+			}
+
+			glm::vec4 tangent(s, glm::dot(glm::cross(n, s), t) < 0.0f ? -1.0f : 1.0f);
+			memcpy(data + v*stride + tangent_offset, &tangent, sizeof(tangent));
+		}
+	});
+}
+
@@ -0,0 +1,36 @@
+/*
+ *Smooth normal and tangent generation
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_NORMALS_H
+#define MESH_NORMALS_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+
+//Area weighted smooth normals for a triangle list.  verts is an interleaved
+//array with a glm::vec3 position at pos_offset and a glm::vec3 normal written
+//at normal_offset.  Vertices split in the index buffer (uv seams) get their
+//own normals, weld positions first if that matters.
+//Triangle normals are computed in parallel, then every vertex sums the
+//triangles around it, also in parallel, so no thread writes anything
+//another one reads or writes.  threads 0 is one per core.  Without a whole
+//triangle nothing is written, by this or compute_tangents().
+void compute_normals(void* verts, size_t vcount, size_t stride, size_t pos_offset, size_t normal_offset,
+                     const GLuint* indices, size_t icount, unsigned int threads = 0);
+
+//Per vertex tangents (glm::vec4, w is the bitangent sign) following the
+//MikkTSpace conventions: each triangle's uv derived tangent is projected
+//into the plane of the vertex normal, angle weighted and summed, then the
+//sign comes from the summed bitangents.  Normals have to be there already.
+//Unlike the reference implementation vertices aren't split when their
+//triangles disagree on the sign (mirrored uvs), weld accordingly.
+void compute_tangents(void* verts, size_t vcount, size_t stride, size_t pos_offset, size_t normal_offset,
+                      size_t tex_offset, size_t tangent_offset, const GLuint* indices, size_t icount,
+                      unsigned int threads = 0);
+
+
+#endif
+
@@ -0,0 +1,193 @@
+/*
+ *Index and vertex reordering for indexed triangle lists
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_optimize.h"
+
+#include <math.h>
+#include <string.h>
+
+
+VertexCacheStats analyze_vertex_cache(const GLuint* indices, size_t index_count, size_t vertex_count, unsigned int cache_size)
+{
+	VertexCacheStats stats = { 0.0f, 0.0f };
+	if (index_count < 3 || !vertex_count)
+		return stats;
+
+	//timestamp of when each vertex entered the FIFO
+	std::vector<size_t> entered(vertex_count, 0);
+	size_t misses = 0;
+
+	for (size_t i=0; i<index_count; ++i) {
+		GLuint v = indices[i];
+		if (!entered[v] || misses + 1 - entered[v] > cache_size) {
+			++misses;
+			entered[v] = misses;
+		}
+	}
+
+	stats.acmr = float(misses) / float(index_count/3);
+	stats.atvr = float(misses) / float(vertex_count);
+	return stats;
+}
+
+
+//Forsyth's scoring, see "Linear-Speed Vertex Cache Optimisation"
+#define FORSYTH_CACHE_SIZE 32
+
+static float cache_score_table[FORSYTH_CACHE_SIZE];
+static float valence_score_table[64];
+
+static bool init_score_tables()
+{
+	const float cache_decay = 1.5f, last_tri_score = 0.75f;
+	const float valence_scale = 2.0f, valence_power = 0.5f;
+
+	for (int i=0; i<FORSYTH_CACHE_SIZE; ++i) {
+		if (i < 3) {
+			cache_score_table[i] = last_tri_score;
+		} else {
+			float s = 1.0f - float(i - 3) / float(FORSYTH_CACHE_SIZE - 3);
+			cache_score_table[i] = powf(s, cache_decay);
+		}
+	}
+	valence_score_table[0] = 0.0f;
+	for (int i=1; i<64; ++i)
+		valence_score_table[i] = valence_scale * powf(float(i), -valence_power);
+
+	return true;
+}
+
+static inline float vertex_score(int cache_pos, unsigned int remaining)
+{
+	if (!remaining)
+		return -1.0f;	//no triangles left, never pick it
+
+	float score = (cache_pos >= 0) ? cache_score_table[cache_pos] : 0.0f;
+	return score + valence_score_table[remaining < 64 ? remaining : 63];
+}
+
+
+void optimize_vertex_cache(GLuint* indices, size_t index_count, size_t vertex_count)
+{
+	size_t tri_count = index_count / 3;
+	if (!tri_count)
+		return;
+
+	//once, even with meshes being optimized on several threads (upload_queue.h)
+	static bool score_tables_init = init_score_tables();
+	(void)score_tables_init;
+
+	//vertex -> triangle adjacency, compacted as triangles are emitted
+	std::vector<unsigned int> remaining(vertex_count, 0);
+	std::vector<unsigned int> offsets(vertex_count+1, 0);
+	for (size_t i=0; i<tri_count*3; ++i)
+		remaining[indices[i]]++;
+	for (size_t v=0; v<vertex_count; ++v)
+		offsets[v+1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(tri_count*3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end()-1);
+	for (size_t t=0; t<tri_count; ++t) {
+		for (int k=0; k<3; ++k)
+			adjacency[fill[indices[t*3+k]]++] = t;
+	}
+
+	std::vector<float> vscore(vertex_count);
+	for (size_t v=0; v<vertex_count; ++v)
+		vscore[v] = vertex_score(-1, remaining[v]);
+
+	std::vector<char> emitted(tri_count, 0);
+
+	std::vector<GLuint> out(tri_count*3);
+
+	//+3 so the vertices of the new triangle fit before anything is evicted
+	GLuint cache[FORSYTH_CACHE_SIZE+3], new_cache[FORSYTH_CACHE_SIZE+3];
+	int cache_count = 0;
+
+	size_t cursor = 0;
+	long best = -1;
+
+	for (size_t n=0; n<tri_count; ++n) {
+		if (best < 0) {
+			//nothing in the cache has triangles left, take the next one in input order
+			while (emitted[cursor])
+				++cursor;
+			best = cursor;
+		}
+
+		const GLuint* tri = &indices[best*3];
+		memcpy(&out[n*3], tri, 3*sizeof(GLuint));
+		emitted[best] = 1;
+
+		//remove the triangle from its vertices' adjacency
+		for (int k=0; k<3; ++k) {
+			GLuint v = tri[k];
+			unsigned int* adj = &adjacency[offsets[v]];
+			for (unsigned int j=0; j<remaining[v]; ++j) {
+				if (adj[j] == (unsigned int)best) {
+					adj[j] = adj[remaining[v]-1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		//new triangle goes to the front of the LRU cache
+		int new_count = 0;
+		for (int k=0; k<3; ++k)
+			new_cache[new_count++] = tri[k];
+		for (int i=0; i<cache_count; ++i) {
+			GLuint v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				new_cache[new_count++] = v;
+		}
+
+		//evicted vertices lose their cache score
+		for (int i=FORSYTH_CACHE_SIZE; i<new_count; ++i)
+			vscore[new_cache[i]] = vertex_score(-1, remaining[new_cache[i]]);
+
+		cache_count = (new_count < FORSYTH_CACHE_SIZE) ? new_count : FORSYTH_CACHE_SIZE;
+		memcpy(cache, new_cache, cache_count*sizeof(GLuint));
+
+		for (int i=0; i<cache_count; ++i)
+			vscore[cache[i]] = vertex_score(i, remaining[cache[i]]);
+
+		//rescore triangles touching the cache and pick the best one
+		best = -1;
+		float best_score = 0.0f;
+		for (int i=0; i<cache_count; ++i) {
+			GLuint v = cache[i];
+			const unsigned int* adj = &adjacency[offsets[v]];
+			for (unsigned int j=0; j<remaining[v]; ++j) {
+				unsigned int t = adj[j];
+				float s = vscore[indices[t*3]] + vscore[indices[t*3+1]] + vscore[indices[t*3+2]];
+				if (s > best_score) {
+					best_score = s;
+					best = t;
+				}
+			}
+		}
+	}
+
+	memcpy(indices, &out[0], tri_count*3*sizeof(GLuint));
+}
+
+
+size_t optimize_vertex_fetch(std::vector<GLuint>& remap, GLuint* indices, size_t index_count, size_t vertex_count)
+{
+	const GLuint unused = ~GLuint(0);
+	remap.assign(vertex_count, unused);
+
+	GLuint next = 0;
+	for (size_t i=0; i<index_count; ++i) {
+		GLuint& r = remap[indices[i]];
+		if (r == unused)
+			r = next++;
+		indices[i] = r;
+	}
+
+	return next;
+}
+
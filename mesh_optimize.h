@@ -0,0 +1,49 @@
+/*
+ *Index and vertex reordering for indexed triangle lists
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <vector>
+#include <stddef.h>
+#include <GL/glew.h>
+
+
+struct VertexCacheStats
+{
+	float acmr;		//average cache miss ratio, transformed vertices per triangle (0.5 - 3.0)
+	float atvr;		//average transformed vertex ratio, transformed vertices per vertex (1.0 is ideal)
+};
+
+
+//Simulates a FIFO post-transform cache of cache_size entries.
+VertexCacheStats analyze_vertex_cache(const GLuint* indices, size_t index_count, size_t vertex_count, unsigned int cache_size = 16);
+
+//Reorders the triangles of an indexed triangle list in place for post-transform
+//cache locality (Tom Forsyth's linear-speed vertex cache optimisation).
+void optimize_vertex_cache(GLuint* indices, size_t index_count, size_t vertex_count);
+
+//Fills remap so that vertices are numbered in order of first use by indices
+//and rewrites indices accordingly.  remap[old] == new, unreferenced vertices
+//get ~0.  Returns the number of referenced vertices.  Apply the remap to the
+//vertex data with remap_vertices().
+size_t optimize_vertex_fetch(std::vector<GLuint>& remap, GLuint* indices, size_t index_count, size_t vertex_count);
+
+
+template<class T, class A>
+void remap_vertices(std::vector<T, A>& verts, const std::vector<GLuint>& remap, size_t new_count)
+{
+	std::vector<T, A> tmp(verts.get_allocator());
+	tmp.resize(new_count);
+	for (size_t i=0; i<remap.size(); ++i) {
+		if (remap[i] != ~GLuint(0))
+			tmp[remap[i]] = verts[i];
+	}
+	verts.swap(tmp);
+}
+
+
+#endif
+
@@ -0,0 +1,205 @@
+/*
+ *Quadric error metric simplification for generating LODs
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_simplify.h"
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+#include <glm/glm.hpp>
+
+
+//Symmetric 4x4 plane quadric, the error of a point p is [p 1] A [p 1]^T.
+//Planes are weighted by triangle area, divided by the total weight the
+//error is a mean squared distance so it stays in model units.
+struct Quadric
+{
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+	double w;
+};
+
+static void quadric_add_plane(Quadric& q, const glm::vec3& n, float d, double w)
+{
+	q.a00 += w*n.x*n.x; q.a01 += w*n.x*n.y; q.a02 += w*n.x*n.z; q.a03 += w*n.x*d;
+	q.a11 += w*n.y*n.y; q.a12 += w*n.y*n.z; q.a13 += w*n.y*d;
+	q.a22 += w*n.z*n.z; q.a23 += w*n.z*d;
+	q.a33 += w*d*d;
+	q.w += w;
+}
+
+static void quadric_add(Quadric& q, const Quadric& r)
+{
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+	q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+	q.a22 += r.a22; q.a23 += r.a23;
+	q.a33 += r.a33;
+	q.w += r.w;
+}
+
+static double quadric_error(const Quadric& q, const glm::vec3& p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a00*x*x + q.a11*y*y + q.a22*z*z + q.a33
+	         + 2*(q.a01*x*y + q.a02*x*z + q.a12*y*z + q.a03*x + q.a13*y + q.a23*z);
+	return e > 0.0 && q.w > 0.0 ? e / q.w : 0.0;
+}
+
+
+struct Collapse
+{
+	GLuint from, to;
+	double error;
+
+	bool operator<(const Collapse& c) const { return error < c.error; }
+};
+
+
+//true if moving from onto to turns any of from's other triangles over
+static bool collapse_flips(const std::vector<glm::vec3>& pos, const GLuint* tris,
+                           const GLuint* adj, GLuint adj_begin, GLuint adj_end, GLuint from, GLuint to)
+{
+	for (GLuint i=adj_begin; i<adj_end; ++i) {
+		const GLuint* t = &tris[adj[i]*3];
+		if (t[0] == to || t[1] == to || t[2] == to)
+			continue;	//goes away
+
+		glm::vec3 p[3], q[3];
+		for (int k=0; k<3; ++k) {
+			p[k] = pos[t[k]];
+			q[k] = t[k] == from ? pos[to] : p[k];
+		}
+		glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+		glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+		if (glm::dot(n0, n1) <= 0.0f)
+			return true;
+	}
+	return false;
+}
+
+
+size_t simplify_mesh(GLuint* out, const GLuint* indices, size_t icount,
+                     const void* verts, size_t vcount, size_t stride, size_t pos_offset,
+                     size_t target_icount, float* error)
+{
+	std::vector<glm::vec3> pos(vcount);
+	for (size_t i=0; i<vcount; ++i)
+		memcpy(&pos[i], (const char*)verts + i*stride + pos_offset, sizeof(glm::vec3));
+
+	memcpy(out, indices, icount*sizeof(GLuint));
+	icount -= icount % 3;
+
+	std::vector<Quadric> quadrics(vcount);
+	memset(&quadrics[0], 0, vcount*sizeof(Quadric));
+	for (size_t i=0; i<icount; i+=3) {
+		const glm::vec3& a = pos[out[i]];
+		glm::vec3 n = glm::cross(pos[out[i+1]] - a, pos[out[i+2]] - a);
+		float len = sqrtf(glm::dot(n, n));
+		if (len == 0.0f)
+			continue;
+		n /= len;
+		float d = -glm::dot(n, a);
+		for (int k=0; k<3; ++k)
+			quadric_add_plane(quadrics[out[i+k]], n, d, len * 0.5f);
+	}
+
+	//a half edge without its opposite is a border, lock both ends
+	std::vector<char> locked(vcount, 0);
+	{
+		std::vector<unsigned long long> edges(icount);
+		for (size_t i=0; i<icount; ++i) {
+			GLuint a = out[i], b = out[i - i%3 + (i+1)%3];
+			edges[i] = (unsigned long long)a << 32 | b;
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i=0; i<icount; ++i) {
+			GLuint a = edges[i] >> 32, b = edges[i] & 0xFFFFFFFF;
+			if (!std::binary_search(edges.begin(), edges.end(), (unsigned long long)b << 32 | a))
+				locked[a] = locked[b] = 1;
+		}
+	}
+
+	double max_error = 0.0;
+	std::vector<Collapse> collapses;
+	std::vector<GLuint> remap(vcount);
+	std::vector<char> touched(vcount);
+	std::vector<GLuint> adj_offset(vcount + 1), adj(icount);
+
+	while (icount > target_icount) {
+		//candidates, every edge in both directions
+		collapses.clear();
+		for (size_t i=0; i<icount; ++i) {
+			GLuint a = out[i], b = out[i - i%3 + (i+1)%3];
+			for (int dir=0; dir<2; ++dir, std::swap(a, b)) {
+				if (locked[a])
+					continue;
+				Quadric q = quadrics[a];
+				quadric_add(q, quadrics[b]);
+				Collapse c = { a, b, quadric_error(q, pos[b]) };
+				collapses.push_back(c);
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end());
+
+		//triangles around each vertex for the flip test
+		std::fill(adj_offset.begin(), adj_offset.end(), 0);
+		for (size_t i=0; i<icount; ++i)
+			adj_offset[out[i] + 1]++;
+		for (size_t v=0; v<vcount; ++v)
+			adj_offset[v+1] += adj_offset[v];
+		std::vector<GLuint> fill(adj_offset.begin(), adj_offset.end() - 1);
+		for (size_t i=0; i<icount; ++i)
+			adj[fill[out[i]]++] = i / 3;
+
+		for (size_t v=0; v<vcount; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		//each collapse removes about 2 triangles, don't overshoot by much
+		size_t wanted = (icount - target_icount) / 6 + 1;
+		size_t done = 0;
+		for (size_t i=0; i<collapses.size() && done<wanted; ++i) {
+			const Collapse& c = collapses[i];
+			if (touched[c.from] || touched[c.to])
+				continue;
+			if (collapse_flips(pos, out, &adj[0], adj_offset[c.from], adj_offset[c.from+1], c.from, c.to))
+				continue;
+
+			remap[c.from] = c.to;
+			quadric_add(quadrics[c.to], quadrics[c.from]);
+			if (c.error > max_error)
+				max_error = c.error;
+
+			//neighbors too, their flip tests assumed from hadn't moved
+			for (GLuint j=adj_offset[c.from]; j<adj_offset[c.from+1]; ++j)
+				for (int k=0; k<3; ++k)
+					touched[out[adj[j]*3 + k]] = 1;
+			++done;
+		}
+		if (!done)
+			break;
+
+		size_t n = 0;
+		for (size_t i=0; i<icount; i+=3) {
+			GLuint a = remap[out[i]], b = remap[out[i+1]], c = remap[out[i+2]];
+			if (a == b || b == c || a == c)
+				continue;
+			out[n++] = a;
+			out[n++] = b;
+			out[n++] = c;
+		}
+		icount = n;
+	}
+
+	if (error)
+		*error = (float)sqrt(max_error);
+	return icount;
+}
+
@@ -0,0 +1,35 @@
+/*
+ *Quadric error metric simplification for generating LODs
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+
+//one level of detail, a range of the mesh's index buffer
+struct MeshLod
+{
+	GLuint first_index;
+	GLuint index_count;
+	float error;		//how far (model units) the surface may be from the original
+};
+
+
+//Garland-Heckbert edge collapse on a triangle list.  Vertices only ever
+//collapse onto other existing vertices, so the vertex buffer is shared by
+//every LOD and attributes are kept exactly; vertices on borders (including
+//uv/normal seams, which are borders in the index topology) never move.
+//Writes at most icount indices to out and returns how many, stopping at
+//target_icount or when nothing more can collapse.  error gets the
+//approximate distance from the original surface.
+size_t simplify_mesh(GLuint* out, const GLuint* indices, size_t icount,
+                     const void* verts, size_t vcount, size_t stride, size_t pos_offset,
+                     size_t target_icount, float* error);
+
+
+#endif
+
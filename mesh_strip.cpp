@@ -0,0 +1,95 @@
+/*
+ *Triangle strips joined with primitive restart
+ *BSD license (see LICENSE)
+ */
+
+#include "mesh_strip.h"
+
+
+#define NO_TRIANGLE	((size_t)-1)
+
+
+//Strip order: triangle k of a strip is (s[k], s[k+1], s[k+2]) when k is
+//even and (s[k+1], s[k], s[k+2]) when it's odd.  So a strip ending in
+//b, c continues with the triangle on the other side of that edge, which in
+//a consistently wound mesh has the directed edge c->b after an even one
+//and b->c after an odd one.
+size_t stripify(std::vector<GLuint>& out, const GLuint* indices, size_t icount, size_t vcount, size_t window)
+{
+	size_t tcount = icount / 3;
+	out.clear();
+	out.reserve(icount);
+
+	//triangles around each vertex
+	std::vector<GLuint> offsets(vcount + 1, 0), tris(tcount*3);
+	for (size_t i=0; i<tcount*3; ++i)
+		offsets[indices[i] + 1]++;
+	for (size_t v=0; v<vcount; ++v)
+		offsets[v+1] += offsets[v];
+	std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i=0; i<tcount*3; ++i)
+		tris[fill[indices[i]]++] = i / 3;
+
+	std::vector<char> used(tcount, 0);
+	for (size_t t=0; t<tcount; ++t) {
+		const GLuint* tri = &indices[t*3];
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+			used[t] = 1;
+	}
+
+	//an unused triangle with the directed edge a->b, at most window past first
+	auto find = [&](GLuint a, GLuint b, size_t first) -> size_t {
+		for (GLuint j=offsets[a]; j<offsets[a+1]; ++j) {
+			GLuint t = tris[j];
+			if (used[t] || (window && t > first + window))
+				continue;
+			const GLuint* tri = &indices[t*3];
+			for (int k=0; k<3; ++k)
+				if (tri[k] == a && tri[(k+1)%3] == b)
+					return t;
+		}
+		return NO_TRIANGLE;
+	};
+
+	for (size_t next=0; next<tcount; ++next) {
+		if (used[next])
+			continue;
+		used[next] = 1;
+
+		//start with the rotation that has somewhere to go
+		const GLuint* tri = &indices[next*3];
+		int rot = 0;
+		for (int r=0; r<3; ++r) {
+			if (find(tri[(r+2)%3], tri[(r+1)%3], next) != NO_TRIANGLE) {
+				rot = r;
+				break;
+			}
+		}
+
+		if (!out.empty())
+			out.push_back(STRIP_RESTART);
+		GLuint b = tri[(rot+1)%3], c = tri[(rot+2)%3];
+		out.push_back(tri[rot]);
+		out.push_back(b);
+		out.push_back(c);
+
+		for (size_t k=1; ; ++k) {
+			size_t t = (k & 1) ? find(c, b, next) : find(b, c, next);
+			if (t == NO_TRIANGLE)
+				break;
+			used[t] = 1;
+
+			const GLuint* n = &indices[t*3];
+			GLuint d = n[0];
+			for (int j=0; j<3; ++j)
+				if (n[j] != b && n[j] != c)
+					d = n[j];
+			out.push_back(d);
+			b = c;
+			c = d;
+		}
+	}
+
+	return out.size();
+}
+
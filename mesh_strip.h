@@ -0,0 +1,35 @@
+/*
+ *Triangle strips joined with primitive restart
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESH_STRIP_H
+#define MESH_STRIP_H
+
+#include <stddef.h>
+#include <vector>
+#include <GL/glew.h>
+
+
+//how far ahead in the list a strip may reach by default
+#define STRIP_WINDOW	16
+
+//what GL_PRIMITIVE_RESTART_FIXED_INDEX uses for GL_UNSIGNED_INT, it becomes
+//0xFFFF when the indices are narrowed to GL_UNSIGNED_SHORT
+#define STRIP_RESTART	0xFFFFFFFF
+
+
+//Turns an indexed triangle list into GL_TRIANGLE_STRIP indices, strips
+//separated by STRIP_RESTART, winding preserved.  Strips start at the first
+//unused triangle in list order and grow through neighbors no more than
+//window triangles further down the list, so a cache optimized order
+//(optimize_vertex_cache) is mostly kept.  Long strips running across the
+//mesh would be smaller but miss the cache far more often; window 0 allows
+//them.  Degenerate triangles are dropped.  Returns out.size(), compare with
+//icount to see if it's worth it.
+size_t stripify(std::vector<GLuint>& out, const GLuint* indices, size_t icount, size_t vcount,
+                size_t window = STRIP_WINDOW);
+
+
+#endif
+
@@ -0,0 +1,210 @@
+/*
+ *Splitting triangle meshes into small clusters that are culled on their own
+ *BSD license (see LICENSE)
+ */
+
+#include "meshlet.h"
+
+#include <string.h>
+#include <math.h>
+
+
+static inline const glm::vec3& position(const void* verts, size_t stride, size_t pos_offset, GLuint i)
+{
+	return *(const glm::vec3*)((const char*)verts + i*stride + pos_offset);
+}
+
+
+//bounds and normal cone of one finished cluster
+static void meshlet_bounds(Meshlet& m, const GLuint* tris, const void* verts, size_t stride, size_t pos_offset)
+{
+	const GLuint* idx = tris + m.first_index;
+	size_t n = m.triangle_count * 3;
+
+	glm::vec3 min = position(verts, stride, pos_offset, idx[0]);
+	glm::vec3 max = min;
+	for (size_t i=1; i<n; ++i) {
+		const glm::vec3& p = position(verts, stride, pos_offset, idx[i]);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	m.box_min = min;
+	m.box_max = max;
+
+	m.center = (min + max) * 0.5f;
+	float r2 = 0.0f;
+	for (size_t i=0; i<n; ++i) {
+		glm::vec3 d = position(verts, stride, pos_offset, idx[i]) - m.center;
+		float l2 = glm::dot(d, d);
+		if (l2 > r2)
+			r2 = l2;
+	}
+	m.radius = sqrtf(r2);
+
+	//axis is the average unit normal, the cone has to hold all of them
+	std::vector<glm::vec3> normals;
+	normals.reserve(m.triangle_count);
+	glm::vec3 axis(0.0f);
+	for (size_t i=0; i<n; i+=3) {
+		const glm::vec3& a = position(verts, stride, pos_offset, idx[i]);
+		const glm::vec3& b = position(verts, stride, pos_offset, idx[i+1]);
+		const glm::vec3& c = position(verts, stride, pos_offset, idx[i+2]);
+		glm::vec3 nrm = glm::cross(b - a, c - a);
+		float len = sqrtf(glm::dot(nrm, nrm));
+		if (len == 0.0f)
+			continue;	//degenerate, faces nowhere
+		nrm /= len;
+		normals.push_back(nrm);
+		axis += nrm;
+	}
+
+	m.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	m.cone_cutoff = 2.0f;
+
+	float len = sqrtf(glm::dot(axis, axis));
+	if (normals.empty() || len == 0.0f)
+		return;
+	axis /= len;
+
+	float mindp = 1.0f;
+	for (size_t i=0; i<normals.size(); ++i) {
+		float dp = glm::dot(axis, normals[i]);
+		if (dp < mindp)
+			mindp = dp;
+	}
+
+	m.cone_axis = axis;
+	if (mindp > 0.0f)	//wider than a hemisphere can never be all back facing
+		m.cone_cutoff = sqrtf(1.0f - mindp*mindp);
+}
+
+
+void build_meshlets(std::vector<Meshlet>& out, GLuint* indices, size_t icount,
+                    const void* verts, size_t vcount, size_t stride, size_t pos_offset,
+                    size_t max_verts, size_t max_tris)
+{
+	out.clear();
+	size_t tcount = icount / 3;
+	if (!tcount)
+		return;
+
+	//triangles using each vertex
+	std::vector<GLuint> adj_offset(vcount + 1, 0);
+	for (size_t i=0; i<tcount*3; ++i)
+		adj_offset[indices[i] + 1]++;
+	for (size_t v=0; v<vcount; ++v)
+		adj_offset[v+1] += adj_offset[v];
+
+	std::vector<GLuint> adj(tcount*3);
+	std::vector<GLuint> fill(adj_offset.begin(), adj_offset.end() - 1);
+	for (size_t i=0; i<tcount*3; ++i)
+		adj[fill[indices[i]]++] = i / 3;
+
+	std::vector<char> used(tcount, 0);
+	std::vector<GLuint> in_cluster(vcount, ~0u);	//cluster number a vertex was last added to
+	std::vector<GLuint> candidates;
+	std::vector<GLuint> result;
+	result.reserve(tcount*3);
+
+	size_t seed = 0;
+	while (1) {
+		while (seed < tcount && used[seed])
+			++seed;
+		if (seed == tcount)
+			break;
+
+		Meshlet m;
+		m.first_index = result.size();
+		m.triangle_count = 0;
+		m.vertex_count = 0;
+		GLuint id = out.size();
+		candidates.clear();
+
+		size_t tri = seed;
+		while (1) {
+			used[tri] = 1;
+			m.triangle_count++;
+			for (int k=0; k<3; ++k) {
+				GLuint v = indices[tri*3 + k];
+				result.push_back(v);
+				if (in_cluster[v] != id) {
+					in_cluster[v] = id;
+					m.vertex_count++;
+					for (GLuint j=adj_offset[v]; j<adj_offset[v+1]; ++j)
+						if (!used[adj[j]])
+							candidates.push_back(adj[j]);
+				}
+			}
+			if (m.triangle_count == max_tris)
+				break;
+
+			//connected triangle adding the fewest vertices
+			size_t best = tcount;
+			int best_new = 4;
+			for (size_t c=0; c<candidates.size(); ) {
+				GLuint t = candidates[c];
+				if (used[t]) {
+					candidates[c] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+				int fresh = (in_cluster[indices[t*3]] != id) + (in_cluster[indices[t*3+1]] != id) + (in_cluster[indices[t*3+2]] != id);
+				if (m.vertex_count + fresh <= max_verts && fresh < best_new) {
+					best_new = fresh;
+					best = t;
+					if (!fresh)
+						break;
+				}
+				++c;
+			}
+			if (best == tcount)
+				break;
+			tri = best;
+		}
+
+		out.push_back(m);
+	}
+
+	memcpy(indices, &result[0], result.size()*sizeof(GLuint));
+
+	for (size_t i=0; i<out.size(); ++i)
+		meshlet_bounds(out[i], indices, verts, stride, pos_offset);
+}
+
+
+size_t cull_meshlets(const Meshlet* meshlets, size_t count, const glm::vec4* planes,
+                     const glm::mat4& model, const glm::vec3& camera, GLuint* visible)
+{
+	glm::mat3 rot(model);
+	float scale = sqrtf(glm::dot(rot[0], rot[0]));
+	for (int i=1; i<3; ++i) {
+		float s = sqrtf(glm::dot(rot[i], rot[i]));
+		if (s > scale)
+			scale = s;
+	}
+	float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+	size_t n = 0;
+	for (size_t i=0; i<count; ++i) {
+		const Meshlet& m = meshlets[i];
+		glm::vec3 c = glm::vec3(model * glm::vec4(m.center, 1.0f));
+		float r = m.radius * scale;
+
+		bool inside = true;
+		for (int p=0; p<6 && inside; ++p)
+			inside = glm::dot(glm::vec3(planes[p]), c) + planes[p].w > -r;
+		if (!inside)
+			continue;
+
+		if (m.cone_cutoff <= 1.0f) {
+			glm::vec3 axis = rot * m.cone_axis * inv_scale;
+			glm::vec3 d = c - camera;
+			if (glm::dot(d, axis) >= m.cone_cutoff * sqrtf(glm::dot(d, d)) + r)
+				continue;
+		}
+
+		visible[n++] = i;
+	}
+	return n;
+}
+
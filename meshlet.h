@@ -0,0 +1,57 @@
+/*
+ *Splitting triangle meshes into small clusters that are culled on their own
+ *BSD license (see LICENSE)
+ */
+
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+#include <stddef.h>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+
+#define MESHLET_MAX_VERTS	64
+#define MESHLET_MAX_TRIS	124
+
+
+//A run of triangles in the (reordered) index buffer plus what's needed to
+//cull it.  Everything is in model space.
+struct Meshlet
+{
+	GLuint first_index;
+	GLuint triangle_count;
+	GLuint vertex_count;		//unique vertices used
+
+	glm::vec3 center;		//bounding sphere
+	float radius;
+	glm::vec3 box_min, box_max;
+
+	//Every triangle normal is within the cone around axis, so the whole
+	//cluster faces away if dot(center - camera, axis) >= cutoff*|center - camera| + radius.
+	//cutoff > 1 means it can't be back face culled.
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+
+
+//Greedily grows clusters of at most max_verts vertices and max_tris
+//triangles, each time adding the connected triangle that brings in the
+//fewest new vertices.  indices (a triangle list) are reordered in place so
+//every cluster is contiguous.  verts is any interleaved vertex array with
+//a glm::vec3 position at pos_offset.
+void build_meshlets(std::vector<Meshlet>& out, GLuint* indices, size_t icount,
+                    const void* verts, size_t vcount, size_t stride, size_t pos_offset,
+                    size_t max_verts = MESHLET_MAX_VERTS, size_t max_tris = MESHLET_MAX_TRIS);
+
+//Frustum (planes as (normal, d) with the inside positive, eg from
+//GLFrustum::get_planes) and back face cone test in world space.  Writes the
+//index of each survivor to visible and returns how many there are.
+//model shouldn't have non uniform scale.
+size_t cull_meshlets(const Meshlet* meshlets, size_t count, const glm::vec4* planes,
+                     const glm::mat4& model, const glm::vec3& camera, GLuint* visible);
+
+
+#endif
+
@@ -0,0 +1,56 @@
+/*
+ *Minimal fork/join helper for the CPU side mesh processing
+ *BSD license (see LICENSE)
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+
+//0 means one per hardware thread
+inline unsigned int worker_count(unsigned int threads)
+{
+	if (!threads) {
+		threads = std::thread::hardware_concurrency();
+		if (!threads)
+			threads = 1;
+	}
+	return threads;
+}
+
+
+//Splits [0, n) into one contiguous range per thread and calls
+//f(task, begin, end) for each, the calling thread takes the first range.
+//Ranges smaller than min_items aren't worth a thread so fewer are used.
+//Returns the number of tasks so callers can size per task output.
+template<class F>
+unsigned int parallel_for(size_t n, unsigned int threads, size_t min_items, F f)
+{
+	threads = worker_count(threads);
+	if (min_items && n / min_items < threads)
+		threads = n / min_items ? n / min_items : 1;
+
+	if (threads == 1) {
+		f(0u, size_t(0), n);
+		return 1;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (unsigned int t=1; t<threads; ++t)
+		workers.push_back(std::thread(f, t, n * t / threads, n * (t+1) / threads));
+
+	f(0u, size_t(0), n / threads);
+
+	for (size_t i=0; i<workers.size(); ++i)
+		workers[i].join();
+	return threads;
+}
+
+
+#endif
+
@@ -0,0 +1,130 @@
+/*
+ *Ring buffer for data rewritten every frame
+ *BSD license (see LICENSE)
+ */
+
+#include "stream_buffer.h"
+
+#include <stdio.h>
+
+
+StreamBuffer::StreamBuffer()
+{
+	buffer = 0;
+	target = GL_ARRAY_BUFFER;
+	region_size = 0;
+	region = 0;
+	used = 0;
+	persistent = false;
+	mapped = NULL;
+	for (int i=0; i<STREAM_REGIONS; ++i)
+		fences[i] = 0;
+}
+
+
+bool StreamBuffer::init(GLenum target, size_t region_size)
+{
+	release();
+
+	this->target = target;
+	this->region_size = region_size;
+	region = 0;
+	used = 0;
+
+	GLsizeiptr total = region_size * STREAM_REGIONS;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(target, buffer);
+
+	persistent = GLEW_ARB_buffer_storage;
+	if (persistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(target, 0, total, flags);
+		if (!mapped) {
+			fprintf(stderr, "StreamBuffer: persistent mapping failed, falling back to glMapBufferRange\n");
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(target, buffer);
+			persistent = false;
+		}
+	}
+
+	if (!persistent)
+		glBufferData(target, total, NULL, GL_STREAM_DRAW);
+
+	return buffer != 0;
+}
+
+
+void StreamBuffer::release()
+{
+	for (int i=0; i<STREAM_REGIONS; ++i) {
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+
+	//deleting unmaps it, binding it here could land in whatever VAO is bound
+	if (buffer)
+		glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	mapped = NULL;
+}
+
+
+void StreamBuffer::advance()
+{
+	if (fences[region])
+		glDeleteSync(fences[region]);
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	region = (region + 1) % STREAM_REGIONS;
+	used = 0;
+
+	if (fences[region]) {
+		//with 3 regions this should almost never actually wait
+		GLenum ret = glClientWaitSync(fences[region], 0, 0);
+		while (ret == GL_TIMEOUT_EXPIRED)
+			ret = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+
+	//without persistent storage orphan the store each time around the ring
+	//so the unsynchronized maps never touch memory the GPU can still read
+	if (!persistent && region == 0) {
+		glBindBuffer(target, buffer);
+		glBufferData(target, region_size * STREAM_REGIONS, NULL, GL_STREAM_DRAW);
+	}
+}
+
+
+void* StreamBuffer::map(size_t bytes, size_t align, size_t* offset)
+{
+	size_t start = (used + align-1) / align * align;
+	if (start + bytes > region_size)
+		return NULL;
+
+	used = start + bytes;
+	*offset = region * region_size + start;
+
+	if (persistent)
+		return mapped + *offset;
+
+	glBindBuffer(target, buffer);
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+	return glMapBufferRange(target, *offset, bytes, flags);
+}
+
+
+void StreamBuffer::unmap()
+{
+	if (persistent)
+		return;
+
+	glBindBuffer(target, buffer);
+	glUnmapBuffer(target);
+}
+
@@ -0,0 +1,63 @@
+/*
+ *Ring buffer for data rewritten every frame
+ *BSD license (see LICENSE)
+ */
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+
+#define STREAM_REGIONS 3
+
+
+//One buffer object split into STREAM_REGIONS regions.  Each frame (advance())
+//the CPU moves to the next region while the GPU may still be reading the
+//previous ones; a fence per region keeps it from overwriting data in flight.
+//
+//With GL_ARB_buffer_storage the whole buffer stays mapped persistent+coherent
+//and map() just returns a pointer.  Otherwise every map() is an unsynchronized
+//glMapBufferRange and the buffer is orphaned each time the ring wraps.
+class StreamBuffer
+{
+public:
+	GLuint buffer;
+	GLenum target;
+	size_t region_size;		//bytes per region
+	int region;			//region currently written
+	size_t used;			//bytes allocated from the current region
+
+	bool persistent;
+	unsigned char* mapped;		//whole buffer when persistent
+	GLsync fences[STREAM_REGIONS];
+
+	StreamBuffer();
+	~StreamBuffer() { release(); }
+
+	//init(), advance() (when not persistent), map() and unmap() bind the
+	//buffer to target.  For GL_ELEMENT_ARRAY_BUFFER that changes the bound
+	//VAO, so bind the one it belongs to around them.  release() binds nothing.
+	bool init(GLenum target, size_t region_size);
+	void release();
+
+	//Fence the region just used, move to the next one and wait (normally not
+	//at all) until the GPU is done with it.
+	void advance();
+
+	//Allocates bytes from the current region, offset receives the offset from
+	//the start of the buffer.  Returns NULL if the region is full.
+	void* map(size_t bytes, size_t align, size_t* offset);
+
+	//Needed after map() when not persistent, no-op otherwise.
+	void unmap();
+
+private:
+	StreamBuffer(const StreamBuffer&);
+	StreamBuffer& operator=(const StreamBuffer&);
+};
+
+
+#endif
+
@@ -0,0 +1,147 @@
+/*
+ *Uniform blocks: std140/std430 structs and a per-frame ring to feed them
+ *BSD license (see LICENSE)
+ */
+
+#include "uniform_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+bool check_uniform_block(GLuint program, const char* block_name, GLuint binding,
+                         const UboMember* members, size_t count, size_t struct_size)
+{
+	GLuint block = glGetUniformBlockIndex(program, block_name);
+	if (block == GL_INVALID_INDEX) {
+		fprintf(stderr, "check_uniform_block: no block %s\n", block_name);
+		return false;
+	}
+
+	bool ok = true;
+	GLint data_size = 0, nuniforms = 0;
+	glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_DATA_SIZE, &data_size);
+	glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &nuniforms);
+	if ((size_t)data_size > struct_size) {
+		fprintf(stderr, "check_uniform_block: %s is %d bytes, the struct only %d\n", block_name, data_size, (int)struct_size);
+		ok = false;
+	}
+
+	if (nuniforms > 0) {
+		vector<GLint> indices(nuniforms);
+		glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, &indices[0]);
+
+		vector<GLuint> uindices(indices.begin(), indices.end());
+		vector<GLint> offsets(nuniforms), array_strides(nuniforms), matrix_strides(nuniforms), row_major(nuniforms);
+		glGetActiveUniformsiv(program, nuniforms, &uindices[0], GL_UNIFORM_OFFSET, &offsets[0]);
+		glGetActiveUniformsiv(program, nuniforms, &uindices[0], GL_UNIFORM_ARRAY_STRIDE, &array_strides[0]);
+		glGetActiveUniformsiv(program, nuniforms, &uindices[0], GL_UNIFORM_MATRIX_STRIDE, &matrix_strides[0]);
+		glGetActiveUniformsiv(program, nuniforms, &uindices[0], GL_UNIFORM_IS_ROW_MAJOR, &row_major[0]);
+
+		GLint max_len = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_len);
+		vector<GLchar> buf(max_len + 1);
+		for (GLint i=0; i<nuniforms; ++i) {
+			GLsizei len = 0;
+			glGetActiveUniformName(program, uindices[i], max_len + 1, &len, &buf[0]);
+
+			//"Block.member[0]" with an instance name, "member[0]" without
+			string name(&buf[0], len);
+			size_t prefix = strlen(block_name);
+			if (!name.compare(0, prefix, block_name) && name.size() > prefix && name[prefix] == '.')
+				name.erase(0, prefix + 1);
+			if (name.size() > 3 && !name.compare(name.size()-3, 3, "[0]"))
+				name.erase(name.size()-3);
+
+			const UboMember* m = NULL;
+			for (size_t j=0; j<count && !m; ++j)
+				if (name == members[j].name)
+					m = &members[j];
+
+			if (!m) {
+				fprintf(stderr, "check_uniform_block: %s.%s isn't in the struct\n", block_name, name.c_str());
+				ok = false;
+			} else if ((size_t)offsets[i] != m->offset) {
+				fprintf(stderr, "check_uniform_block: %s.%s is at %d, the struct has it at %d\n",
+				        block_name, name.c_str(), offsets[i], (int)m->offset);
+				ok = false;
+			} else if (m->array_stride && (size_t)array_strides[i] != m->array_stride) {
+				fprintf(stderr, "check_uniform_block: %s.%s has array stride %d, the struct %d\n",
+				        block_name, name.c_str(), array_strides[i], (int)m->array_stride);
+				ok = false;
+			} else if (matrix_strides[i] && (matrix_strides[i] != 16 || row_major[i])) {
+				fprintf(stderr, "check_uniform_block: %s.%s must be a column major matrix with vec4 columns\n",
+				        block_name, name.c_str());
+				ok = false;
+			}
+		}
+	}
+
+	if (ok)
+		glUniformBlockBinding(program, block, binding);
+	return ok;
+}
+
+
+
+UniformRing::UniformRing()
+{
+	align = 256;
+}
+
+
+bool UniformRing::init(size_t frame_size)
+{
+	GLint a = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &a);
+	if (a > 0)
+		align = a;
+
+	//whole regions of aligned slots, so every region starts aligned too
+	frame_size = (frame_size + align-1) / align * align;
+	return stream.init(GL_UNIFORM_BUFFER, frame_size);
+}
+
+
+void UniformRing::release()
+{
+	stream.release();
+}
+
+
+void UniformRing::next_frame()
+{
+	stream.advance();
+}
+
+
+void* UniformRing::alloc(size_t size, size_t* offset)
+{
+	return stream.map(size, align, offset);
+}
+
+
+void UniformRing::bind_range(GLuint binding, size_t offset, size_t size)
+{
+	stream.unmap();
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, stream.buffer, offset, size);
+}
+
+
+bool UniformRing::bind(GLuint binding, const void* data, size_t size)
+{
+	size_t offset;
+	void* p = alloc(size, &offset);
+	if (!p)
+		return false;
+
+	memcpy(p, data, size);
+	bind_range(binding, offset, size);
+	return true;
+}
+
@@ -0,0 +1,161 @@
+/*
+ *Uniform blocks: std140/std430 structs and a per-frame ring to feed them
+ *BSD license (see LICENSE)
+ */
+
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include "stream_buffer.h"
+
+#include <stddef.h>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+
+enum UboLayout { UBO_STD140, UBO_STD430 };
+
+
+//Base alignment of a block member.  Declared with UBO_MEMBER, C++ puts every
+//member at the same offset std140/std430 does, so a struct can be copied
+//into the buffer as is.  glm::mat3 and arrays of anything smaller than a
+//vec4 aren't laid out like GLSL wants, use ubo_mat3 and ubo_array instead.
+template<class T> struct ubo_align;
+template<> struct ubo_align<float> { enum { value = 4 }; };
+template<> struct ubo_align<int> { enum { value = 4 }; };
+template<> struct ubo_align<unsigned int> { enum { value = 4 }; };
+template<> struct ubo_align<glm::vec2> { enum { value = 8 }; };
+template<> struct ubo_align<glm::ivec2> { enum { value = 8 }; };
+template<> struct ubo_align<glm::vec3> { enum { value = 16 }; };
+template<> struct ubo_align<glm::ivec3> { enum { value = 16 }; };
+template<> struct ubo_align<glm::vec4> { enum { value = 16 }; };
+template<> struct ubo_align<glm::ivec4> { enum { value = 16 }; };
+template<> struct ubo_align<glm::mat4> { enum { value = 16 }; };
+
+//typedef anything with a comma in it (ubo_array) first
+#define UBO_MEMBER(type, name) alignas(ubo_align<type >::value) type name
+
+
+//mat3 with its columns padded to vec4, the same in both layouts
+struct ubo_mat3
+{
+	glm::vec4 cols[3];
+
+	ubo_mat3() {}
+	ubo_mat3(const glm::mat3& m)
+	{
+		for (int i=0; i<3; ++i)
+			cols[i] = glm::vec4(m[i], 0.0f);
+	}
+};
+template<> struct ubo_align<ubo_mat3> { enum { value = 16 }; };
+
+
+//T followed by pad bytes
+template<class T, size_t pad>
+struct ubo_padded
+{
+	T v;
+	unsigned char padding[pad];
+};
+
+template<class T>
+struct ubo_padded<T, 0>
+{
+	T v;
+};
+
+
+//T[N] with the array stride of the layout: std140 rounds every element up
+//to 16 bytes, std430 only to the element's own alignment
+template<class T, size_t N, UboLayout L = UBO_STD140>
+struct ubo_array
+{
+	enum {
+		align = (L == UBO_STD140 && ubo_align<T>::value < 16) ? 16 : ubo_align<T>::value,
+		stride = (sizeof(T) + align - 1) / align * align
+	};
+
+	ubo_padded<T, stride - sizeof(T)> elems[N];
+
+	T& operator[](size_t i) { return elems[i].v; }
+	const T& operator[](size_t i) const { return elems[i].v; }
+	size_t size() const { return N; }
+};
+
+template<class T, size_t N, UboLayout L>
+struct ubo_align<ubo_array<T, N, L> > { enum { value = ubo_array<T, N, L>::align }; };
+
+
+template<class T> struct ubo_stride { enum { value = 0 }; };
+template<class T, size_t N, UboLayout L>
+struct ubo_stride<ubo_array<T, N, L> > { enum { value = ubo_array<T, N, L>::stride }; };
+
+
+//One member of a block struct, where it is and the array stride (0 if it
+//isn't one), all known at compile time.  Build a table of them with
+//UBO_DESCRIBE to check the struct against the linked program.
+struct UboMember
+{
+	const char* name;
+	size_t offset;
+	size_t array_stride;
+};
+
+#define UBO_DESCRIBE(S, m) { #m, offsetof(S, m), (size_t)ubo_stride<decltype(S::m)>::value }
+
+
+//Looks up block_name in a linked program, checks that every member GL
+//reports is in members at the same offset (and array stride), that
+//matrices are column major with vec4 columns and that the block fits in
+//struct_size bytes.  Then points the block at binding.  Prints what's
+//wrong and returns false on a mismatch.
+bool check_uniform_block(GLuint program, const char* block_name, GLuint binding,
+                         const UboMember* members, size_t count, size_t struct_size);
+
+template<class T, size_t N>
+bool check_uniform_block(GLuint program, const char* block_name, GLuint binding, const UboMember (&members)[N])
+{
+	static_assert(sizeof(T) % 16 == 0, "blocks round up to 16 bytes, declare the struct alignas(16)");
+	return check_uniform_block(program, block_name, binding, members, N, sizeof(T));
+}
+
+
+//Block data for the current frame goes into a StreamBuffer region,
+//each bind() copies a struct in at GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT and
+//points a binding at it with glBindBufferRange.  Call next_frame() once a
+//frame, after the last draw using it.
+class UniformRing
+{
+public:
+	StreamBuffer stream;
+	size_t align;
+
+	UniformRing();
+
+	//frame_size bytes per frame, STREAM_REGIONS frames in flight
+	bool init(size_t frame_size = 1 << 20);
+	void release();
+
+	void next_frame();
+
+	//Copies size bytes to the ring and binds them to binding.  Returns false
+	//if the frame's space has run out.
+	bool bind(GLuint binding, const void* data, size_t size);
+
+	template<class T>
+	bool bind(GLuint binding, const T& block) { return bind(binding, &block, sizeof(T)); }
+
+	//To write in place: alloc() (NULL when full), fill it, then
+	//bind_range() with the offset it gave.
+	void* alloc(size_t size, size_t* offset);
+	void bind_range(GLuint binding, size_t offset, size_t size);
+
+private:
+	UniformRing(const UniformRing&);
+	UniformRing& operator=(const UniformRing&);
+};
+
+
+#endif
+
@@ -0,0 +1,274 @@
+/*
+ *Background mesh uploads through a staging ring
+ *BSD license (see LICENSE)
+ */
+
+#include "upload_queue.h"
+
+#include <stdio.h>
+
+
+#define NO_STAGING	((size_t)-1)
+
+
+UploadQueue::UploadQueue()
+{
+	staging = 0;
+	mapped = NULL;
+	ring_size = head = tail = used = 0;
+	queued = 0;
+	stopping = false;
+}
+
+UploadQueue::~UploadQueue()
+{
+	release();
+}
+
+
+bool UploadQueue::init(size_t staging_size, unsigned int threads)
+{
+	release();
+
+	if (GLEW_ARB_buffer_storage && staging_size) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &staging);
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+		glBufferStorage(GL_COPY_READ_BUFFER, staging_size, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, staging_size, flags);
+		if (!mapped) {
+			fprintf(stderr, "UploadQueue: persistent mapping failed, staging in plain memory\n");
+			glDeleteBuffers(1, &staging);
+			staging = 0;
+		} else {
+			ring_size = staging_size;
+		}
+	}
+
+	stopping = false;
+	if (!threads)
+		threads = 1;
+	for (unsigned int i=0; i<threads; ++i)
+		workers.push_back(std::thread(&UploadQueue::worker, this));
+
+	return true;
+}
+
+
+//Unfinished jobs are dropped, their meshes never become resident
+void UploadQueue::release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_cv.notify_all();
+	space_cv.notify_all();
+	for (size_t i=0; i<workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	for (size_t i=0; i<waiting.size(); ++i)
+		delete waiting[i];
+	waiting.clear();
+	for (size_t i=0; i<slots.size(); ++i)
+		delete slots[i].job;
+	slots.clear();
+	for (size_t i=0; i<retired.size(); ++i)
+		glDeleteSync(retired[i].fence);
+	retired.clear();
+
+	if (staging) {
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glDeleteBuffers(1, &staging);
+	}
+	staging = 0;
+	mapped = NULL;
+	ring_size = head = tail = used = 0;
+	queued = 0;
+}
+
+
+void UploadQueue::push(UploadJob* job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		waiting.push_back(job);
+		++queued;
+	}
+	work_cv.notify_one();
+}
+
+
+size_t UploadQueue::pending()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return queued;
+}
+
+
+//Contiguous space after head, or at the start if the end is too short (the
+//skipped bytes count against the allocation until it's freed).
+//Called with the mutex held.
+bool UploadQueue::ring_alloc(size_t bytes, size_t& offset, size_t& footprint)
+{
+	if (!used)
+		head = tail = 0;
+
+	if (head >= tail && used < ring_size) {
+		if (head + bytes <= ring_size) {
+			offset = head;
+			footprint = bytes;
+		} else if (bytes <= tail) {
+			offset = 0;
+			footprint = ring_size - head + bytes;
+		} else {
+			return false;
+		}
+	} else if (head < tail && head + bytes <= tail) {
+		offset = head;
+		footprint = bytes;
+	} else {
+		return false;
+	}
+
+	head = (offset + bytes) % ring_size;
+	used += footprint;
+	return true;
+}
+
+
+void UploadQueue::worker()
+{
+	for (;;) {
+		UploadJob* job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && waiting.empty())
+				work_cv.wait(lock);
+			if (stopping)
+				return;
+			job = waiting.front();
+			waiting.pop_front();
+		}
+
+		size_t bytes = job->prepare();
+
+		//16 byte aligned ring allocations
+		size_t rounded = (bytes + 15) & ~size_t(15);
+		Slot* s;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			size_t offset = NO_STAGING, footprint = 0;
+			if (staging && rounded <= ring_size) {
+				while (!stopping && !ring_alloc(rounded, offset, footprint))
+					space_cv.wait(lock);
+				if (stopping) {
+					delete job;
+					return;
+				}
+			}
+
+			Slot slot = { job, bytes, 0, offset, footprint, std::vector<unsigned char>(), false };
+			slots.push_back(slot);
+			s = &slots.back();
+		}
+
+		//nothing else looks at the slot until written is set
+		unsigned char* dst;
+		if (s->offset == NO_STAGING) {
+			s->heap.resize(bytes ? bytes : 1);
+			dst = &s->heap[0];
+		} else {
+			dst = mapped + s->offset;
+		}
+		job->write(dst);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		s->written = true;
+	}
+}
+
+
+//frees the ring space of copies the GPU has finished
+void UploadQueue::retire()
+{
+	while (!retired.empty()) {
+		if (glClientWaitSync(retired.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			break;
+		glDeleteSync(retired.front().fence);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tail = retired.front().tail;
+			used -= retired.front().footprint;
+		}
+		retired.pop_front();
+		space_cv.notify_all();
+	}
+}
+
+
+//Only pump() removes slots, so the front one stays valid without the lock
+//while its copies are issued.
+size_t UploadQueue::pump(size_t budget)
+{
+	retire();
+
+	size_t done = 0;
+	Retired r = { 0, 0, 0 };
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!slots.empty() && slots.front().written && (done < budget || !done)) {
+		Slot& s = slots.front();
+		lock.unlock();
+
+		if (!s.copied)
+			s.job->begin();
+
+		size_t left = budget > done ? budget - done : 0;
+		if (!left)
+			left = s.size - s.copied;	//first step always goes all the way
+		size_t last = (s.size - s.copied <= left) ? s.size : s.copied + left;
+		if (s.offset == NO_STAGING)
+			s.job->copy(s.copied, last, 0, 0, &s.heap[0]);
+		else
+			s.job->copy(s.copied, last, staging, s.offset, NULL);
+		done += last - s.copied;
+		s.copied = last;
+
+		if (s.copied < s.size) {
+			lock.lock();
+			break;
+		}
+
+		s.job->finish();
+		delete s.job;
+		if (s.offset != NO_STAGING) {
+			r.tail = (s.offset + ((s.size + 15) & ~size_t(15))) % ring_size;
+			r.footprint += s.footprint;
+		}
+
+		lock.lock();
+		slots.pop_front();
+		--queued;
+		if (!done)
+			break;		//empty job, counts as the step
+	}
+	lock.unlock();
+
+	if (r.footprint) {
+		r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		retired.push_back(r);
+	}
+	return done;
+}
+
+
+void UploadQueue::drain()
+{
+	while (pending()) {
+		if (!pump((size_t)-1))
+			std::this_thread::yield();
+	}
+}
+
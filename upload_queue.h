@@ -0,0 +1,255 @@
+/*
+ *Background mesh uploads through a staging ring
+ *BSD license (see LICENSE)
+ */
+
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+
+#include "Mesh.h"
+
+
+//One upload.  prepare() and write() run on a worker thread and must not
+//touch GL, the rest runs on the render thread from UploadQueue::pump().
+class UploadJob
+{
+public:
+	virtual ~UploadJob() {}
+
+	//CPU side processing, returns the bytes of staging memory wanted
+	virtual size_t prepare() = 0;
+	virtual void write(unsigned char* dst) = 0;
+
+	//Before the first copy(): allocate the destination buffers
+	virtual void begin() = 0;
+
+	//Bytes [first, last) of what write() wrote, either from the staging
+	//buffer where byte 0 is at staging_offset or, if staging is 0, from
+	//memory at src (byte 0).  Big jobs are split over several pumps.
+	virtual void copy(size_t first, size_t last, GLuint staging, size_t staging_offset, const unsigned char* src) = 0;
+
+	//every copy() has been issued
+	virtual void finish() = 0;
+};
+
+
+//Worker threads run the jobs' CPU side and write their data straight into
+//a persistently mapped staging buffer (GL_ARB_buffer_storage).  The render
+//thread calls pump() once a frame, which copies up to budget bytes to the
+//real buffers with glCopyBufferSubData, so loading never stalls a frame for
+//longer than that.  Staging space is reused once a fence says the copies
+//reading it are done.  Jobs that don't fit the ring, or every job without
+//buffer storage, go through plain memory and glBufferSubData instead.
+//
+//Copies are issued in the order jobs got their staging space; GL calls only
+//ever happen in init(), pump() and release().
+class UploadQueue
+{
+public:
+	UploadQueue();
+	~UploadQueue();
+
+	bool init(size_t staging_size = 16 << 20, unsigned int threads = 1);
+	void release();
+
+	//takes ownership, the job is deleted after finish()
+	void push(UploadJob* job);
+
+	//Returns the bytes copied.  At least one step is made every call.
+	size_t pump(size_t budget = 4 << 20);
+
+	//pumps (without a budget) until everything queued is copied
+	void drain();
+
+	size_t pending();
+
+private:
+	struct Slot
+	{
+		UploadJob* job;
+		size_t size;
+		size_t copied;
+		size_t offset;			//in the ring, (size_t)-1 if heap is used
+		size_t footprint;		//ring bytes, including any skipped at the end
+		std::vector<unsigned char> heap;
+		bool written;
+	};
+
+	//ring space freed once fence signals
+	struct Retired
+	{
+		GLsync fence;
+		size_t tail;
+		size_t footprint;
+	};
+
+	GLuint staging;
+	unsigned char* mapped;
+	size_t ring_size, head, tail, used;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_cv, space_cv;
+	std::deque<UploadJob*> waiting;
+	std::deque<Slot> slots;			//in ring allocation order
+	std::deque<Retired> retired;
+	size_t queued;				//pushed and not finished
+	bool stopping;
+
+	void worker();
+	bool ring_alloc(size_t bytes, size_t& offset, size_t& footprint);
+	void retire();
+
+	UploadQueue(const UploadQueue&);
+	UploadQueue& operator=(const UploadQueue&);
+};
+
+
+//Mesh::end() in the background.  Everything end() does on the CPU plus the
+//packing happens on a worker, nothing on the mesh may be touched (by the
+//application) until resident() says it's there.  Static meshes only.
+template<class Vertex, class Alloc>
+class MeshUpload : public UploadJob
+{
+public:
+	typedef Mesh<Vertex, Alloc> mesh_type;
+	typedef gpu_vertex<Vertex> gpu;
+
+	MeshUpload(mesh_type& m) : mesh(m) {}
+
+	size_t prepare()
+	{
+		mesh.prepare();
+
+		vcount = mesh.verts.size();
+		vbytes = gpu::stride * vcount;
+		base = mesh.stripped ? &mesh.strip_indices : &mesh.indices;
+		icount = mesh.indexed ? base->size() + mesh.lod_indices.size() : 0;
+		itype = (vcount <= 0xFFFF) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		ioffset = (vbytes + 15) & ~size_t(15);
+		ibytes = icount * (itype == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		return ioffset + ibytes;
+	}
+
+	void write(unsigned char* dst)
+	{
+		if (mesh_type::layout::packed && vcount)
+			gpu::pack(&mesh.verts[0], vcount, dst, mesh.quant);
+		else if (vcount)
+			memcpy(dst, &mesh.verts[0], vbytes);
+
+		if (!icount)
+			return;
+		const std::vector<GLuint>* src[2] = { base, &mesh.lod_indices };
+		unsigned char* out = dst + ioffset;
+		for (int k=0; k<2; ++k) {
+			const std::vector<GLuint>& v = *src[k];
+			if (itype == GL_UNSIGNED_SHORT) {
+				GLushort* s = (GLushort*)out;
+				for (size_t i=0; i<v.size(); ++i)
+					s[i] = v[i];
+				out += v.size() * sizeof(GLushort);
+			} else if (!v.empty()) {
+				memcpy(out, &v[0], v.size() * sizeof(GLuint));
+				out += v.size() * sizeof(GLuint);
+			}
+		}
+	}
+
+	void begin()
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.vbo);
+		glBufferData(GL_COPY_WRITE_BUFFER, vbytes, NULL, GL_STATIC_DRAW);
+		if (icount) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.ibo);
+			glBufferData(GL_COPY_WRITE_BUFFER, ibytes, NULL, GL_STATIC_DRAW);
+		}
+	}
+
+	void copy(size_t first, size_t last, GLuint staging, size_t staging_offset, const unsigned char* src)
+	{
+		copy_range(mesh.vbo, 0, vbytes, first, last, staging, staging_offset, src);
+		if (icount)
+			copy_range(mesh.ibo, ioffset, ibytes, first, last, staging, staging_offset, src);
+	}
+
+	void finish()
+	{
+		mesh.index_type = itype;
+		mesh.draw_count = mesh.indexed ? base->size() : vcount;
+		mesh.base_vertex = 0;
+		mesh.index_offset = 0;
+		mesh.gpu_capacity = mesh.gpu_count = vcount;
+		mesh.dirty.clear();
+		mesh.all_dirty = mesh.indices_dirty = false;
+		mesh.ibo_bytes = ibytes;
+		mesh.update_gpu_size();
+
+		if (mesh.upload_fence)
+			glDeleteSync(mesh.upload_fence);
+		mesh.upload_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		mesh.uploading = false;
+	}
+
+private:
+	mesh_type& mesh;
+	size_t vcount, vbytes, icount, ioffset, ibytes;
+	GLenum itype;
+	const std::vector<GLuint>* base;	//strips or list
+
+	//the part of [first, last) inside [start, start+size) goes to buffer
+	static void copy_range(GLuint buffer, size_t start, size_t size, size_t first, size_t last,
+	                       GLuint staging, size_t staging_offset, const unsigned char* src)
+	{
+		size_t lo = first > start ? first : start;
+		size_t hi = last < start + size ? last : start + size;
+		if (lo >= hi)
+			return;
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (staging) {
+			glBindBuffer(GL_COPY_READ_BUFFER, staging);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staging_offset + lo, lo - start, hi - lo);
+		} else {
+			glBufferSubData(GL_COPY_WRITE_BUFFER, lo - start, hi - lo, src + lo);
+		}
+	}
+};
+
+
+//Call on the render thread.  The VAO and buffer names are made right away
+//so set_instances() etc. work, the data follows over the next pumps.
+template<class Vertex, class Alloc>
+void end_async(UploadQueue& queue, Mesh<Vertex, Alloc>& mesh)
+{
+	if (!mesh.vao) {
+		glGenVertexArrays(1, &mesh.vao);
+		glBindVertexArray(mesh.vao);
+		glGenBuffers(1, &mesh.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+		gpu_vertex<Vertex>::setup();
+		glBindVertexArray(0);
+	}
+	if (!mesh.ibo && mesh.indexed) {
+		//the element binding is VAO state
+		glGenBuffers(1, &mesh.ibo);
+		glBindVertexArray(mesh.vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+		glBindVertexArray(0);
+	}
+
+	mesh.uploading = true;
+	queue.push(new MeshUpload<Vertex, Alloc>(mesh));
+}
+
+
+#endif
+
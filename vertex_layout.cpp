@@ -0,0 +1,142 @@
+/*
+ *Compile time description of interleaved vertex formats
+ *BSD license (see LICENSE)
+ */
+
+#include "vertex_layout.h"
+
+#include <string.h>
+#include <math.h>
+
+
+void set_quant_box(QuantBox& box, const glm::vec3& min, const glm::vec3& max)
+{
+	box.min = min;
+	box.extent = max - min;
+	for (int i=0; i<3; ++i) {
+		if (box.extent[i] <= 0.0f)
+			box.extent[i] = 1.0f;	//flat in this axis, anything works
+		box.inv_extent[i] = 1.0f / box.extent[i];
+	}
+}
+
+
+//round to nearest even, handles denormals, overflow goes to inf
+unsigned short float_to_half(float f)
+{
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+
+	unsigned int sign = (x >> 16) & 0x8000;
+	int exp = ((x >> 23) & 0xFF) - 127 + 15;
+	unsigned int mant = x & 0x7FFFFF;
+
+	if (((x >> 23) & 0xFF) == 0xFF)
+		return sign | 0x7C00 | (mant ? 0x200 : 0);	//inf or nan
+
+	if (exp >= 31)
+		return sign | 0x7C00;
+
+	if (exp <= 0) {
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		unsigned int shift = 14 - exp;
+		unsigned int h = mant >> shift;
+		unsigned int rem = mant & ((1u << shift) - 1);
+		unsigned int half = 1u << (shift - 1);
+		if (rem > half || (rem == half && (h & 1)))
+			++h;
+		return sign | h;
+	}
+
+	unsigned int h = (exp << 10) | (mant >> 13);
+	unsigned int rem = mant & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		++h;	//may carry into the exponent which is still correct
+	return sign | h;
+}
+
+
+//Octahedral mapping: project onto |x|+|y|+|z| = 1 and fold the lower
+//hemisphere over the diagonals.  In GLSL:
+//	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);   (sign 0 counts as +1)
+//	n = normalize(n);
+glm::vec2 oct_encode(const glm::vec3& n)
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0.0f)
+		return glm::vec2(0.0f, 0.0f);
+
+	glm::vec2 e(n.x / l1, n.y / l1);
+	if (n.z < 0.0f) {
+		glm::vec2 f((1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+		            (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f));
+		e = f;
+	}
+	return e;
+}
+
+
+static inline float clampf(float x, float lo, float hi)
+{
+	return x < lo ? lo : (x > hi ? hi : x);
+}
+
+static inline short to_snorm16(float x)
+{
+	return (short)lrintf(clampf(x, -1.0f, 1.0f) * 32767.0f);
+}
+
+
+void pack_attrib(int format, const float* src, int n, unsigned char* dst, const QuantBox& box)
+{
+	switch (format) {
+	case VF_FLOAT:
+		memcpy(dst, src, n*sizeof(float));
+		break;
+
+	case VF_HALF: {
+		unsigned short h[4] = { 0, 0, 0, 0 };
+		for (int i=0; i<n; ++i)
+			h[i] = float_to_half(src[i]);
+		memcpy(dst, h, (n*2 + 3) & ~3);
+		break;
+	}
+
+	case VF_SNORM16: {
+		short s[4] = { 0, 0, 0, 0 };
+		for (int i=0; i<n; ++i)
+			s[i] = to_snorm16(src[i]);
+		memcpy(dst, s, (n*2 + 3) & ~3);
+		break;
+	}
+
+	case VF_UNORM16_BOX: {
+		unsigned short u[4] = { 0, 0, 0, 0 };
+		for (int i=0; i<n && i<3; ++i)
+			u[i] = (unsigned short)lrintf(clampf((src[i] - box.min[i]) * box.inv_extent[i], 0.0f, 1.0f) * 65535.0f);
+		memcpy(dst, u, (n*2 + 3) & ~3);
+		break;
+	}
+
+	case VF_INT_2_10_10_10: {
+		unsigned int v = 0;
+		for (int i=0; i<n && i<3; ++i)
+			v |= ((unsigned int)lrintf(clampf(src[i], -1.0f, 1.0f) * 511.0f) & 0x3FF) << (i*10);
+		if (n == 4)
+			v |= (src[3] < 0.0f ? 3u : 1u) << 30;	//-1 or 1, 2 bit snorm
+		memcpy(dst, &v, 4);
+		break;
+	}
+
+	case VF_OCT16: {
+		glm::vec2 e = oct_encode(glm::vec3(src[0], src[1], src[2]));
+		short s[2] = { to_snorm16(e.x), to_snorm16(e.y) };
+		memcpy(dst, s, 4);
+		break;
+	}
+	}
+}
+
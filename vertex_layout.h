@@ -0,0 +1,326 @@
+/*
+ *Compile time description of interleaved vertex formats
+ *BSD license (see LICENSE)
+ */
+
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <stddef.h>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+
+#define ATTRIBUTE_VERTEX	0
+#define ATTRIBUTE_NORMAL	1
+#define ATTRIBUTE_TEXCOORD	2
+#define ATTRIBUTE_COLOR		3
+#define ATTRIBUTE_TANGENT	4
+
+//per instance data, a mat4 takes 4 locations (see Mesh::set_instances)
+#define ATTRIBUTE_INSTANCE	8
+
+
+//number of components and GL type for each C++ member type
+template<class T> struct attrib_traits;
+
+template<> struct attrib_traits<float>      { enum { size = 1 }; static const GLenum type = GL_FLOAT; };
+template<> struct attrib_traits<glm::vec2>  { enum { size = 2 }; static const GLenum type = GL_FLOAT; };
+template<> struct attrib_traits<glm::vec3>  { enum { size = 3 }; static const GLenum type = GL_FLOAT; };
+template<> struct attrib_traits<glm::vec4>  { enum { size = 4 }; static const GLenum type = GL_FLOAT; };
+
+
+//How an attribute is stored on the GPU.  The C++ vertex always holds floats,
+//anything but VF_FLOAT is converted when the mesh is uploaded.
+enum
+{
+	VF_FLOAT,		//as is
+	VF_HALF,		//GL_HALF_FLOAT, good for uvs
+	VF_SNORM16,		//GL_SHORT normalized, values in [-1, 1]
+	VF_UNORM16_BOX,		//GL_UNSIGNED_SHORT normalized relative to the mesh's bounding box, positions only
+	VF_INT_2_10_10_10,	//GL_INT_2_10_10_10_REV, unit vectors (w of a vec4 tangent becomes -1/1)
+	VF_OCT16		//octahedral encoded unit vec3 as 2 snorm16, decode in the shader (see oct_encode)
+};
+
+//size in bytes is always padded to 4
+template<int Format> struct format_traits;
+
+template<> struct format_traits<VF_FLOAT>
+{
+	static constexpr int components(int n) { return n; }
+	static constexpr size_t size(int n) { return n*4; }
+	static const GLenum type = GL_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+};
+template<> struct format_traits<VF_HALF>
+{
+	static constexpr int components(int n) { return n; }
+	static constexpr size_t size(int n) { return (n*2 + 3) & ~3; }
+	static const GLenum type = GL_HALF_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+};
+template<> struct format_traits<VF_SNORM16>
+{
+	static constexpr int components(int n) { return n; }
+	static constexpr size_t size(int n) { return (n*2 + 3) & ~3; }
+	static const GLenum type = GL_SHORT;
+	static const GLboolean normalized = GL_TRUE;
+};
+template<> struct format_traits<VF_UNORM16_BOX>
+{
+	static constexpr int components(int n) { return n; }
+	static constexpr size_t size(int n) { return (n*2 + 3) & ~3; }
+	static const GLenum type = GL_UNSIGNED_SHORT;
+	static const GLboolean normalized = GL_TRUE;
+};
+template<> struct format_traits<VF_INT_2_10_10_10>
+{
+	static constexpr int components(int) { return 4; }
+	static constexpr size_t size(int) { return 4; }
+	static const GLenum type = GL_INT_2_10_10_10_REV;
+	static const GLboolean normalized = GL_TRUE;
+};
+template<> struct format_traits<VF_OCT16>
+{
+	static constexpr int components(int) { return 2; }
+	static constexpr size_t size(int) { return 4; }
+	static const GLenum type = GL_SHORT;
+	static const GLboolean normalized = GL_TRUE;
+};
+
+
+//maps positions into [0, 1] for VF_UNORM16_BOX
+struct QuantBox
+{
+	glm::vec3 min;
+	glm::vec3 extent;
+	glm::vec3 inv_extent;
+};
+
+void set_quant_box(QuantBox& box, const glm::vec3& min, const glm::vec3& max);
+
+//converts n floats to format at dst, see vertex_layout.cpp
+void pack_attrib(int format, const float* src, int n, unsigned char* dst, const QuantBox& box);
+
+unsigned short float_to_half(float f);
+glm::vec2 oct_encode(const glm::vec3& n);
+
+
+//One attribute: shader location, byte offset in the vertex, member type and
+//GPU format.  Everything is a template parameter so setup() compiles down to
+//the two GL calls.
+template<GLuint Location, size_t Offset, class T, int Format = VF_FLOAT>
+struct vertex_attrib
+{
+	static const GLuint location = Location;
+	static const size_t offset = Offset;
+	static const int format = Format;
+	static const size_t packed_size = format_traits<Format>::size(attrib_traits<T>::size);
+	typedef T type;
+
+	static void setup(GLsizei stride, size_t gpu_offset)
+	{
+		glEnableVertexAttribArray(Location);
+		glVertexAttribPointer(Location, format_traits<Format>::components(attrib_traits<T>::size),
+		                      format_traits<Format>::type, format_traits<Format>::normalized, stride, (const GLvoid*)gpu_offset);
+	}
+
+	static void pack(const unsigned char* vertex, unsigned char* out, const QuantBox& box)
+	{
+		pack_attrib(Format, (const float*)(vertex + Offset), attrib_traits<T>::size, out, box);
+	}
+};
+
+
+template<class... Attribs> struct vertex_layout;
+
+//folds one attribute into a layout signature (FNV-1a style)
+constexpr unsigned int layout_hash_step(unsigned int h, unsigned int v)
+{
+	return (h ^ v) * 16777619u;
+}
+
+
+template<>
+struct vertex_layout<>
+{
+	static const unsigned int signature = 2166136261u;
+	static const bool packed = false;
+	static const bool needs_box = false;
+	static const size_t packed_size = 0;
+
+	static void setup(GLsizei) { }
+	template<size_t Base> static void setup_packed(GLsizei) { }
+	template<size_t Base> static void pack(const unsigned char*, unsigned char*, const QuantBox&) { }
+
+	static constexpr bool has(GLuint) { return false; }
+	static constexpr size_t offset_of(GLuint) { return size_t(-1); }
+	static constexpr int components_of(GLuint) { return 0; }
+};
+
+template<class A, class... Rest>
+struct vertex_layout<A, Rest...>
+{
+	typedef vertex_layout<Rest...> rest;
+
+	//true if anything is stored as other than plain floats
+	static const bool packed = A::format != VF_FLOAT || rest::packed;
+	static const bool needs_box = A::format == VF_UNORM16_BOX || rest::needs_box;
+	static const size_t packed_size = A::packed_size + rest::packed_size;
+
+	//identifies the GPU side format, used to validate cached data
+	static const unsigned int signature =
+		layout_hash_step(layout_hash_step(layout_hash_step(layout_hash_step(layout_hash_step(rest::signature,
+			A::location), A::format), attrib_traits<typename A::type>::size), A::packed_size), A::offset);
+
+	//unpacked, the buffer is just an array of Vertex
+	static void setup(GLsizei stride)
+	{
+		A::setup(stride, A::offset);
+		rest::setup(stride);
+	}
+
+	//packed, attributes back to back from Base
+	template<size_t Base>
+	static void setup_packed(GLsizei stride)
+	{
+		A::setup(stride, Base);
+		rest::template setup_packed<Base + A::packed_size>(stride);
+	}
+
+	template<size_t Base>
+	static void pack(const unsigned char* vertex, unsigned char* out, const QuantBox& box)
+	{
+		A::pack(vertex, out + Base, box);
+		rest::template pack<Base + A::packed_size>(vertex, out, box);
+	}
+
+	static constexpr bool has(GLuint loc) { return A::location == loc || rest::has(loc); }
+	static constexpr size_t offset_of(GLuint loc) { return A::location == loc ? A::offset : rest::offset_of(loc); }
+	static constexpr int components_of(GLuint loc) { return A::location == loc ? attrib_traits<typename A::type>::size : rest::components_of(loc); }
+};
+
+
+//Specialize for each vertex struct, usually with VERTEX_LAYOUT.  It can't be
+//a typedef inside the struct since offsetof needs a complete type.
+template<class Vertex> struct vertex_format;
+
+#define VERTEX_ATTRIB(Vertex, member, location) \
+	vertex_attrib<location, offsetof(Vertex, member), decltype(Vertex::member)>
+
+#define VERTEX_ATTRIB_PACKED(Vertex, member, location, format) \
+	vertex_attrib<location, offsetof(Vertex, member), decltype(Vertex::member), format>
+
+#define VERTEX_LAYOUT(Vertex, ...) \
+	template<> struct vertex_format<Vertex> { typedef vertex_layout<__VA_ARGS__> layout; }
+
+
+//What actually goes in the vertex buffer for a Vertex
+template<class Vertex>
+struct gpu_vertex
+{
+	typedef typename vertex_format<Vertex>::layout layout;
+
+	static const size_t stride = layout::packed ? layout::packed_size : sizeof(Vertex);
+
+	static const unsigned int signature = layout_hash_step(layout::signature, stride);
+
+	//with the buffer bound to GL_ARRAY_BUFFER and the VAO bound
+	static void setup()
+	{
+		if (layout::packed)
+			layout::template setup_packed<0>(stride);
+		else
+			layout::setup(stride);
+	}
+
+	//out needs count*stride bytes, only called for packed layouts
+	static void pack(const Vertex* v, size_t count, unsigned char* out, const QuantBox& box)
+	{
+		for (size_t i=0; i<count; ++i)
+			layout::template pack<0>((const unsigned char*)&v[i], out + i*stride, box);
+	}
+};
+
+
+//plain positions, what Mesh always used
+template<> struct vertex_format<glm::vec3>
+{
+	typedef vertex_layout< vertex_attrib<ATTRIBUTE_VERTEX, 0, glm::vec3> > layout;
+};
+
+
+//every vertex format needs a glm::vec3 position
+template<class Vertex>
+inline const glm::vec3& vertex_position(const Vertex& v)
+{
+	typedef typename vertex_format<Vertex>::layout layout;
+	static_assert(layout::has(ATTRIBUTE_VERTEX), "vertex format has no ATTRIBUTE_VERTEX");
+
+	return *(const glm::vec3*)((const char*)&v + layout::offset_of(ATTRIBUTE_VERTEX));
+}
+
+template<class Vertex>
+inline glm::vec3& vertex_position(Vertex& v)
+{
+	return const_cast<glm::vec3&>(vertex_position((const Vertex&)v));
+}
+
+
+//a few common formats
+struct Vertex_PN
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+};
+VERTEX_LAYOUT(Vertex_PN,
+	VERTEX_ATTRIB(Vertex_PN, pos, ATTRIBUTE_VERTEX),
+	VERTEX_ATTRIB(Vertex_PN, normal, ATTRIBUTE_NORMAL));
+
+struct Vertex_PNT
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec2 tex;
+};
+VERTEX_LAYOUT(Vertex_PNT,
+	VERTEX_ATTRIB(Vertex_PNT, pos, ATTRIBUTE_VERTEX),
+	VERTEX_ATTRIB(Vertex_PNT, normal, ATTRIBUTE_NORMAL),
+	VERTEX_ATTRIB(Vertex_PNT, tex, ATTRIBUTE_TEXCOORD));
+
+struct Vertex_PC
+{
+	glm::vec3 pos;
+	glm::vec4 color;
+};
+VERTEX_LAYOUT(Vertex_PC,
+	VERTEX_ATTRIB(Vertex_PC, pos, ATTRIBUTE_VERTEX),
+	VERTEX_ATTRIB(Vertex_PC, color, ATTRIBUTE_COLOR));
+
+//for normal mapping, tangent.w is the sign of the bitangent
+struct Vertex_PNTT
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec2 tex;
+	glm::vec4 tangent;
+};
+VERTEX_LAYOUT(Vertex_PNTT,
+	VERTEX_ATTRIB(Vertex_PNTT, pos, ATTRIBUTE_VERTEX),
+	VERTEX_ATTRIB(Vertex_PNTT, normal, ATTRIBUTE_NORMAL),
+	VERTEX_ATTRIB(Vertex_PNTT, tex, ATTRIBUTE_TEXCOORD),
+	VERTEX_ATTRIB(Vertex_PNTT, tangent, ATTRIBUTE_TANGENT));
+
+//Vertex_PNT in 16 bytes instead of 32.  Positions are relative to the mesh
+//box so the model matrix needs Mesh::dequant_matrix() multiplied in.
+struct Vertex_PNT_Q : public Vertex_PNT
+{
+};
+VERTEX_LAYOUT(Vertex_PNT_Q,
+	VERTEX_ATTRIB_PACKED(Vertex_PNT_Q, pos, ATTRIBUTE_VERTEX, VF_UNORM16_BOX),
+	VERTEX_ATTRIB_PACKED(Vertex_PNT_Q, normal, ATTRIBUTE_NORMAL, VF_INT_2_10_10_10),
+	VERTEX_ATTRIB_PACKED(Vertex_PNT_Q, tex, ATTRIBUTE_TEXCOORD, VF_HALF));
+
+
+#endif
+